@@ -0,0 +1,659 @@
+/*******************************************************************************
+* Image Server Load Generator
+*
+* Description:
+*     Open-loop client for the image server. It first registers a corpus of
+*     images (the BMP files in a folder plus optional synthetic images of
+*     given sizes), remembering the MD5 digest of each. It then issues a
+*     weighted mix of image operations on the registered images at Poisson
+*     arrival times, without waiting for responses. RETRIEVE results are
+*     checked against the registration digests. At the end it reports
+*     throughput and latency percentiles for each opcode.
+*
+* Usage:
+*     <build directory>/client [-a <arrival rate>] [-n <num requests>]
+*         [-I <images folder>] [-g <WxH,WxH,...>] [-m <mix>] [-r <seed>]
+*         [-e RAW|RGB|LZ] [-o <records csv>] [-R <summary csv>] <port_number>
+*
+* Parameters:
+*     arrival rate - Mean number of operations per second.
+*     mix          - Comma-separated OPCODE=weight list, with OPCODE one of
+*                    ROT90, BLUR, SHARPEN, VERTEDGES, HORIZEDGES, RETRIEVE.
+*                    Opcodes not listed are not issued. Default: all at 1.
+*     WxH          - Size of a synthetic random image to add to the corpus.
+*     -e           - Wire encoding of the images, both for uploads and for
+*                    RETRIEVE replies (see codeclib.h). Default: RAW.
+*
+* Creation Date:
+*     October 19, 2026
+*
+* Notes:
+*     All operations use overwrite = 0, so registered images never change
+*     and any RETRIEVE whose digest does not match the registration is a
+*     server bug. Latency is measured from the scheduled send time to the
+*     end of the response (including the image payload for RETRIEVE), so
+*     a sender that falls behind does not hide queueing delay.
+*
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+/* Include struct definitions and other libraries that need to be
+ * included by both client and server */
+#include "common.h"
+
+/* Scheduling, percentiles and draining shared with hw2224/client */
+#include "loadlib.h"
+
+#define USAGE_STRING							\
+	"Usage: %s [-a <arrival rate>] [-n <num requests>] "		\
+	"[-I <images folder>] [-g <WxH,...>] [-m <OPCODE=weight,...>] "	\
+	"[-r <seed>] [-e RAW|RGB|LZ] [-o <records csv>] [-R <summary csv>] <port_number>\n"
+
+/* Give up on outstanding responses after this many seconds without
+ * any progress */
+#define DRAIN_TIMEOUT 5.0
+
+/* Opcodes that can be part of the mix, indexed by enum img_opcode */
+#define OPCODE_COUNT (IMG_RETRIEVE + 1)
+
+const char * mix_names [OPCODE_COUNT] = {
+	[IMG_ROT90CLKW]  = "ROT90",
+	[IMG_BLUR]       = "BLUR",
+	[IMG_SHARPEN]    = "SHARPEN",
+	[IMG_VERTEDGES]  = "VERTEDGES",
+	[IMG_HORIZEDGES] = "HORIZEDGES",
+	[IMG_RETRIEVE]   = "RETRIEVE",
+};
+
+const char * encoding_names [IMG_ENC_COUNT] = {
+	[IMG_ENC_RAW] = "RAW",
+	[IMG_ENC_RGB] = "RGB",
+	[IMG_ENC_LZ]  = "LZ",
+};
+
+/* One registered image of the corpus */
+struct corpus_entry {
+	char name[64];
+	uint64_t img_id;
+	uint32_t width;
+	uint32_t height;
+	struct md5digest digest;
+};
+
+/* One operation of the open-loop phase, indexed by req_id minus the
+ * number of registrations */
+struct op_record {
+	uint8_t opcode;
+	int target;          /* Index in the corpus */
+	double intended;     /* Scheduled send time (from start) */
+	double sent;
+	double completed;    /* 0 if no response */
+	int ack;             /* -1 if no response */
+	int verified;        /* RETRIEVE only: 1 ok, 0 mismatch */
+};
+
+struct client_params {
+	double arrival_rate;
+	long num_requests;
+	const char * images_dir;
+	const char * synth_sizes;
+	double weights[OPCODE_COUNT];
+	unsigned short seed[3];
+	const char * records_file;
+	const char * summary_file;
+};
+
+/* Encoding of uploads and of the RETRIEVE replies we ask for */
+int wire_encoding = IMG_ENC_RAW;
+
+/* State shared between the sender and the receiver */
+struct corpus_entry * corpus;
+int corpus_count;
+struct op_record * ops;
+long op_count;
+uint64_t first_op_id;
+struct timespec start_time;
+volatile long completed_count = 0;
+
+/* Receive exactly <len> bytes, returns 0 on success */
+static int recv_all(int sockfd, void * buf, size_t len)
+{
+	char * ptr = (char *)buf;
+	while (len) {
+		ssize_t cur = recv(sockfd, ptr, len, 0);
+		if (cur <= 0) {
+			return 1;
+		}
+		ptr += cur;
+		len -= cur;
+	}
+	return 0;
+}
+
+/* Tell the server which encodings RETRIEVE replies may use. Only
+ * sent for encodings other than raw, which every server accepts. */
+static int hello(int sockfd)
+{
+	struct request req;
+	struct response resp;
+
+	memset(&req, 0, sizeof(req));
+	clock_gettime(CLOCK_MONOTONIC, &req.req_timestamp);
+	req.img_op = IMG_HELLO;
+	req.img_id = IMG_ENC_BIT(IMG_ENC_RAW) | IMG_ENC_BIT(wire_encoding);
+
+	if (send(sockfd, &req, sizeof(req), 0) != sizeof(req) ||
+	    recv_all(sockfd, &resp, sizeof(resp)) || resp.ack != RESP_COMPLETED) {
+		ERROR_INFO();
+		fprintf(stderr, "Encoding negotiation failed\n");
+		return 1;
+	}
+
+	if (!IMG_ENC_ACCEPTS(resp.img_id, wire_encoding)) {
+		fprintf(stderr, "WARNING: server replies will not use %s\n",
+			encoding_names[wire_encoding]);
+	}
+	return 0;
+}
+
+/* Register <img> on the server and record it in the corpus */
+static int register_image(int sockfd, struct image * img, const char * name,
+			  struct md5digest digest, uint64_t req_id)
+{
+	struct request req;
+	struct response resp;
+	struct corpus_entry * entry;
+
+	memset(&req, 0, sizeof(req));
+	req.req_id = req_id;
+	clock_gettime(CLOCK_MONOTONIC, &req.req_timestamp);
+	req.img_op = IMG_REGISTER;
+
+	if (send(sockfd, &req, sizeof(req), 0) != sizeof(req) ||
+	    sendImageEncoded(img, sockfd, wire_encoding)) {
+		ERROR_INFO();
+		perror("Unable to send image registration");
+		return 1;
+	}
+
+	if (recv_all(sockfd, &resp, sizeof(resp)) || resp.ack != RESP_COMPLETED) {
+		ERROR_INFO();
+		fprintf(stderr, "Registration of %s failed\n", name);
+		return 1;
+	}
+
+	corpus = (struct corpus_entry *)realloc(corpus, (corpus_count + 1) * sizeof(*corpus));
+	entry = &corpus[corpus_count++];
+	snprintf(entry->name, sizeof(entry->name), "%s", name);
+	entry->img_id = resp.img_id;
+	entry->width = img->width;
+	entry->height = img->height;
+	entry->digest = digest;
+
+	printf("INFO: registered %s (%ux%u) as image %lu\n", name,
+	       img->width, img->height, resp.img_id);
+	return 0;
+}
+
+/* Add an image to the list of those to register */
+static void add_pending(struct image *** imgs, char (** names)[64], int * count,
+			struct image * img, const char * name)
+{
+	*imgs = (struct image **)realloc(*imgs, (*count + 1) * sizeof(**imgs));
+	*names = (char (*)[64])realloc(*names, (*count + 1) * sizeof(**names));
+	(*imgs)[*count] = img;
+	snprintf((*names)[*count], sizeof(**names), "%s", name);
+	(*count)++;
+}
+
+/* Register all the BMP files in <dir> and all the synthetic images,
+ * returning the number of requests used. The images are loaded
+ * first so that their digests can be computed together. */
+static uint64_t register_corpus(int sockfd, struct client_params * p)
+{
+	struct image ** imgs = NULL;
+	char (* names)[64] = NULL;
+	const char ** bufs;
+	size_t * lens;
+	struct md5digest * digests;
+	int count = 0, i;
+	struct dirent * entry;
+	DIR * dir;
+	char path[512];
+
+	if (p->images_dir && (dir = opendir(p->images_dir))) {
+		while ((entry = readdir(dir)) != NULL) {
+			size_t len = strlen(entry->d_name);
+			struct image * img;
+
+			if (len < 4 || strcmp(entry->d_name + len - 4, ".bmp")) {
+				continue;
+			}
+
+			snprintf(path, sizeof(path), "%s/%s", p->images_dir, entry->d_name);
+			img = loadBMP(path);
+			if (!img) {
+				fprintf(stderr, "WARNING: unable to load %s\n", path);
+				continue;
+			}
+
+			add_pending(&imgs, &names, &count, img, entry->d_name);
+		}
+		closedir(dir);
+	} else if (p->images_dir) {
+		fprintf(stderr, "WARNING: unable to open %s\n", p->images_dir);
+	}
+
+	if (p->synth_sizes) {
+		const char * spec = p->synth_sizes;
+		unsigned int w, h;
+		int used;
+
+		while (sscanf(spec, "%ux%u%n", &w, &h, &used) == 2) {
+			struct image * img = createImage(w, h);
+			uint64_t k;
+
+			for (k = 0; k < (uint64_t)w * h; ++k) {
+				img->pixels[k] = (uint32_t)nrand48(p->seed) & 0x00ffffff;
+			}
+
+			snprintf(path, sizeof(path), "synthetic-%ux%u", w, h);
+			add_pending(&imgs, &names, &count, img, path);
+
+			spec += used;
+			if (*spec != ',') {
+				break;
+			}
+			++spec;
+		}
+	}
+
+	/* Digest the whole corpus with the multi-buffer MD5 */
+	bufs = (const char **)malloc((count + 1) * sizeof(*bufs));
+	lens = (size_t *)malloc((count + 1) * sizeof(*lens));
+	digests = (struct md5digest *)malloc((count + 1) * sizeof(*digests));
+	for (i = 0; i < count; ++i) {
+		bufs[i] = (const char *)imgs[i]->pixels;
+		lens[i] = imgs[i]->width * imgs[i]->height * sizeof(uint32_t);
+	}
+	buf_md5sum_multi(bufs, lens, digests, count);
+
+	for (i = 0; i < count; ++i) {
+		if (register_image(sockfd, imgs[i], names[i], digests[i], i)) {
+			exit(EXIT_FAILURE);
+		}
+		deleteImage(imgs[i]);
+	}
+
+	free(bufs);
+	free(lens);
+	free(digests);
+	free(imgs);
+	free(names);
+	return count;
+}
+
+/* Parse a mix such as "BLUR=2,RETRIEVE=1" into per-opcode weights */
+static int parse_mix(const char * spec, double weights[OPCODE_COUNT])
+{
+	char name[32];
+	double weight;
+	int used, op;
+
+	memset(weights, 0, OPCODE_COUNT * sizeof(double));
+
+	while (sscanf(spec, "%31[A-Z0-9]=%lf%n", name, &weight, &used) == 2) {
+		for (op = IMG_ROT90CLKW; op < OPCODE_COUNT; ++op) {
+			if (!strcmp(name, mix_names[op])) {
+				break;
+			}
+		}
+		if (op == OPCODE_COUNT || weight < 0) {
+			return 1;
+		}
+		weights[op] = weight;
+
+		spec += used;
+		if (*spec != ',') {
+			break;
+		}
+		++spec;
+	}
+
+	return (*spec != '\0');
+}
+
+/* Draw the opcode, the target and the send time of every operation */
+static void build_schedule(struct client_params * p)
+{
+	double total = 0.0, t = 0.0, pick;
+	long i;
+	int op;
+
+	for (op = 0; op < OPCODE_COUNT; ++op) {
+		total += p->weights[op];
+	}
+
+	op_count = p->num_requests;
+	ops = (struct op_record *)calloc(op_count, sizeof(struct op_record));
+
+	for (i = 0; i < op_count; ++i) {
+		if (i > 0) {
+			t += -log(1.0 - erand48(p->seed)) / p->arrival_rate;
+		}
+
+		pick = erand48(p->seed) * total;
+		for (op = IMG_ROT90CLKW; op < IMG_RETRIEVE; ++op) {
+			if (pick < p->weights[op]) {
+				break;
+			}
+			pick -= p->weights[op];
+		}
+
+		ops[i].opcode = op;
+		ops[i].target = nrand48(p->seed) % corpus_count;
+		ops[i].intended = t;
+		ops[i].ack = -1;
+		ops[i].verified = -1;
+	}
+}
+
+/* Receiver thread: match responses to operations and verify the
+ * payload of RETRIEVE requests */
+void * receiver_main(void * arg)
+{
+	int sockfd = *(int *)arg;
+	struct response resp;
+	struct op_record * op;
+
+	while (recv_all(sockfd, &resp, sizeof(resp)) == 0) {
+		if (resp.req_id < first_op_id || resp.req_id - first_op_id >= (uint64_t)op_count) {
+			fprintf(stderr, "WARNING: response for unknown request %lu\n", resp.req_id);
+			continue;
+		}
+
+		op = &ops[resp.req_id - first_op_id];
+
+		if (op->opcode == IMG_RETRIEVE && resp.ack == RESP_COMPLETED) {
+			struct md5digest digest;
+			struct image * img = recvImageDigest(sockfd, &digest);
+
+			if (!img) {
+				fprintf(stderr, "ERROR: truncated image for request %lu\n", resp.req_id);
+				break;
+			}
+
+			op->verified = !memcmp(&digest, &corpus[op->target].digest, sizeof(digest));
+			if (!op->verified) {
+				fprintf(stderr, "ERROR: RETRIEVE R%lu of %s returned a different image\n",
+					resp.req_id, corpus[op->target].name);
+			}
+			deleteImage(img);
+		}
+
+		op->completed = load_elapsed(&start_time);
+		op->ack = resp.ack;
+		__atomic_add_fetch(&completed_count, 1, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+/* Print one line per opcode and optionally append them to the
+ * summary CSV. Returns the number of failed verifications. */
+static long report(struct client_params * p, double duration)
+{
+	double * lat = (double *)malloc(op_count * sizeof(double));
+	long i, mismatches = 0;
+	int op;
+	FILE * f = NULL;
+
+	if (p->summary_file) {
+		f = fopen(p->summary_file, "a");
+		if (!f) {
+			perror(p->summary_file);
+			exit(EXIT_FAILURE);
+		}
+		if (ftell(f) == 0) {
+			fprintf(f, "opcode,arrival_rate,sent,completed,rejected,lost,"
+				"throughput,mean,p50,p90,p99,p999,max,verified,mismatched\n");
+		}
+	}
+
+	printf("%-11s %7s %7s %7s %7s %10s %10s %10s %10s %10s %10s %7s\n",
+	       "OPCODE", "SENT", "DONE", "REJ", "LOST", "TPUT/s",
+	       "MEAN", "P50", "P90", "P99", "MAX", "BAD");
+
+	for (op = IMG_ROT90CLKW; op < OPCODE_COUNT; ++op) {
+		long sent = 0, done = 0, rejected = 0, lost = 0, verified = 0, bad = 0;
+		struct load_summary sum;
+
+		for (i = 0; i < op_count; ++i) {
+			if (ops[i].opcode != op) {
+				continue;
+			}
+			sent++;
+			if (ops[i].ack < 0) {
+				lost++;
+			} else if (ops[i].ack != RESP_COMPLETED) {
+				rejected++;
+			} else {
+				lat[done++] = ops[i].completed - ops[i].intended;
+				verified += (ops[i].verified == 1);
+				bad += (ops[i].verified == 0);
+			}
+		}
+
+		if (!sent) {
+			continue;
+		}
+
+		load_summarize(lat, done, &sum);
+		mismatches += bad;
+
+		printf("%-11s %7ld %7ld %7ld %7ld %10.3f %10.6f %10.6f %10.6f %10.6f %10.6f %7ld\n",
+		       mix_names[op], sent, done, rejected, lost,
+		       (duration > 0 ? done / duration : 0.0), sum.mean,
+		       sum.p50, sum.p90, sum.p99, sum.max, bad);
+
+		if (f) {
+			fprintf(f, "%s,%.6f,%ld,%ld,%ld,%ld,%.6f,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%ld,%ld\n",
+				mix_names[op], p->arrival_rate, sent, done, rejected, lost,
+				(duration > 0 ? done / duration : 0.0), sum.mean,
+				sum.p50, sum.p90, sum.p99, sum.p999, sum.max, verified, bad);
+		}
+	}
+
+	if (f) {
+		fclose(f);
+	}
+	free(lat);
+	return mismatches;
+}
+
+static void write_records(const char * path)
+{
+	FILE * f = fopen(path, "w");
+	long i;
+
+	if (!f) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(f, "req_id,opcode,image,intended,sent,completed,latency,ack,verified\n");
+	for (i = 0; i < op_count; ++i) {
+		struct op_record * r = &ops[i];
+		fprintf(f, "%lu,%s,%lu,%.9f,%.9f,%.9f,%.9f,%d,%d\n",
+			first_op_id + i, mix_names[r->opcode], corpus[r->target].img_id,
+			r->intended, r->sent, r->completed,
+			(r->ack >= 0 ? r->completed - r->intended : -1.0), r->ack, r->verified);
+	}
+	fclose(f);
+}
+
+int main(int argc, char ** argv)
+{
+	struct client_params p;
+	struct sockaddr_in addr;
+	pthread_t receiver;
+	int sockfd, opt, port;
+	long i, missing;
+	double duration;
+
+	memset(&p, 0, sizeof(p));
+	p.arrival_rate = 10.0;
+	p.num_requests = 1000;
+	p.images_dir = "images";
+	for (opt = IMG_ROT90CLKW; opt < OPCODE_COUNT; ++opt) {
+		p.weights[opt] = 1.0;
+	}
+	p.seed[0] = 0x330e;
+	p.seed[1] = 0x1234;
+	p.seed[2] = 0xabcd;
+
+	while ((opt = getopt(argc, argv, "a:n:I:g:m:r:e:o:R:")) != -1) {
+		switch (opt) {
+		case 'a':
+			p.arrival_rate = strtod(optarg, NULL);
+			break;
+		case 'n':
+			p.num_requests = strtol(optarg, NULL, 10);
+			break;
+		case 'I':
+			p.images_dir = optarg;
+			break;
+		case 'g':
+			p.synth_sizes = optarg;
+			break;
+		case 'm':
+			if (parse_mix(optarg, p.weights)) {
+				fprintf(stderr, "Invalid operation mix: %s\n" USAGE_STRING, optarg, argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'r':
+			p.seed[0] = (unsigned short)strtoul(optarg, NULL, 10);
+			p.seed[1] = (unsigned short)(strtoul(optarg, NULL, 10) >> 16);
+			break;
+		case 'e':
+			for (wire_encoding = 0; wire_encoding < IMG_ENC_COUNT; ++wire_encoding) {
+				if (!strcmp(optarg, encoding_names[wire_encoding])) {
+					break;
+				}
+			}
+			if (wire_encoding == IMG_ENC_COUNT) {
+				fprintf(stderr, "Invalid encoding: %s\n" USAGE_STRING, optarg, argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'o':
+			p.records_file = optarg;
+			break;
+		case 'R':
+			p.summary_file = optarg;
+			break;
+		default:
+			fprintf(stderr, USAGE_STRING, argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind >= argc || p.arrival_rate <= 0 || p.num_requests <= 0) {
+		fprintf(stderr, USAGE_STRING, argv[0]);
+		return EXIT_FAILURE;
+	}
+	port = strtol(argv[optind], NULL, 10);
+
+	sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (sockfd < 0 || connect(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		ERROR_INFO();
+		perror("Unable to connect to server");
+		return EXIT_FAILURE;
+	}
+
+	/* Ask for RETRIEVE replies in the chosen encoding */
+	if (wire_encoding != IMG_ENC_RAW && hello(sockfd)) {
+		return EXIT_FAILURE;
+	}
+
+	/* Phase 1: register the corpus, one image at a time */
+	first_op_id = register_corpus(sockfd, &p);
+	if (corpus_count == 0) {
+		fprintf(stderr, "No images to register.\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Phase 2: open-loop operations */
+	build_schedule(&p);
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	pthread_create(&receiver, NULL, receiver_main, &sockfd);
+
+	for (i = 0; i < op_count; ++i) {
+		struct op_record * r = &ops[i];
+		struct request req;
+
+		load_sleep_until(&start_time, r->intended);
+
+		memset(&req, 0, sizeof(req));
+		req.req_id = first_op_id + i;
+		clock_gettime(CLOCK_MONOTONIC, &req.req_timestamp);
+		req.img_op = r->opcode;
+		req.overwrite = 0;
+		req.img_id = corpus[r->target].img_id;
+		r->sent = load_elapsed(&start_time);
+
+		if (send(sockfd, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req)) {
+			ERROR_INFO();
+			perror("Unable to send request");
+			break;
+		}
+	}
+
+	/* Wait for the responses to what was sent */
+	missing = load_drain(&completed_count, i, DRAIN_TIMEOUT);
+	if (missing) {
+		fprintf(stderr, "WARNING: giving up on %ld requests without response\n", missing);
+	}
+
+	shutdown(sockfd, SHUT_RDWR);
+	pthread_join(receiver, NULL);
+	close(sockfd);
+
+	duration = 0.0;
+	for (i = 0; i < op_count; ++i) {
+		if (ops[i].completed > duration) {
+			duration = ops[i].completed;
+		}
+	}
+
+	if (p.records_file) {
+		write_records(p.records_file);
+	}
+
+	/* Non-zero exit status if any RETRIEVE came back corrupted, so
+	 * that the client can gate server changes in scripts */
+	if (report(&p, duration)) {
+		fprintf(stderr, "ERROR: RETRIEVE verification failed\n");
+		return EXIT_FAILURE;
+	}
+
+	free(ops);
+	free(corpus);
+	return EXIT_SUCCESS;
+}
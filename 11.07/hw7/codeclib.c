@@ -0,0 +1,304 @@
+/*******************************************************************************
+* Image Wire Codec Library (implementation)
+*
+* Description:
+*     RGB packing, delta coding and an LZ4-style byte codec for image
+*     transfers. See codeclib.h for the formats.
+*
+* Creation Date:
+*     October 19, 2026
+*
+* Notes:
+*     The pack/unpack loops have an SSSE3 version that moves 4 pixels
+*     per PSHUFB; it is selected at run time and the scalar loops
+*     finish the tail and serve CPUs without SSSE3.
+*
+*******************************************************************************/
+
+#include <string.h>
+
+#include "codeclib.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_SSSE3_PATH 1
+#endif
+
+/* Scalar packing of pixels [from, count) */
+static int rgb_pack_scalar(const uint32_t * pixels, size_t from, size_t count, uint8_t * out)
+{
+	uint32_t top = 0;
+	size_t i;
+
+	for (i = from; i < count; ++i) {
+		uint32_t p = pixels[i];
+		top |= p;
+		out[3 * i] = p;
+		out[3 * i + 1] = p >> 8;
+		out[3 * i + 2] = p >> 16;
+	}
+
+	return (top >> 24) != 0;
+}
+
+static void rgb_unpack_scalar(const uint8_t * in, size_t from, size_t count, uint32_t * pixels)
+{
+	size_t i;
+
+	for (i = from; i < count; ++i) {
+		pixels[i] = in[3 * i] | (in[3 * i + 1] << 8) | ((uint32_t)in[3 * i + 2] << 16);
+	}
+}
+
+#ifdef HAVE_SSSE3_PATH
+/* 4 pixels (16 bytes) in, 12 bytes out. The store writes 16 bytes,
+ * so the last group is left to the scalar loop. */
+__attribute__((target("ssse3")))
+static size_t rgb_pack_ssse3(const uint32_t * pixels, size_t count, uint8_t * out, __m128i * top)
+{
+	const __m128i shuf = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+					   -1, -1, -1, -1);
+	__m128i acc = _mm_setzero_si128();
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(pixels + i));
+		acc = _mm_or_si128(acc, v);
+		_mm_storeu_si128((__m128i *)(out + 3 * i), _mm_shuffle_epi8(v, shuf));
+	}
+
+	*top = acc;
+	return i;
+}
+
+/* 12 bytes in, 4 pixels out. The load reads 16 bytes, hence the
+ * same margin as above. */
+__attribute__((target("ssse3")))
+static size_t rgb_unpack_ssse3(const uint8_t * in, size_t count, uint32_t * pixels)
+{
+	const __m128i shuf = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+					   6, 7, 8, -1, 9, 10, 11, -1);
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + 3 * i));
+		_mm_storeu_si128((__m128i *)(pixels + i), _mm_shuffle_epi8(v, shuf));
+	}
+
+	return i;
+}
+#endif
+
+int rgb_pack(const uint32_t * pixels, size_t count, uint8_t * out)
+{
+	size_t done = 0;
+	int bad = 0;
+
+#ifdef HAVE_SSSE3_PATH
+	if (__builtin_cpu_supports("ssse3")) {
+		__m128i top;
+		uint32_t lanes[4];
+
+		done = rgb_pack_ssse3(pixels, count, out, &top);
+		_mm_storeu_si128((__m128i *)lanes, top);
+		bad = ((lanes[0] | lanes[1] | lanes[2] | lanes[3]) >> 24) != 0;
+	}
+#endif
+
+	return rgb_pack_scalar(pixels, done, count, out) || bad;
+}
+
+void rgb_unpack(const uint8_t * in, size_t count, uint32_t * pixels)
+{
+	size_t done = 0;
+
+#ifdef HAVE_SSSE3_PATH
+	if (__builtin_cpu_supports("ssse3")) {
+		done = rgb_unpack_ssse3(in, count, pixels);
+	}
+#endif
+
+	rgb_unpack_scalar(in, done, count, pixels);
+}
+
+void delta_encode(uint8_t * buf, size_t len, size_t stride)
+{
+	size_t i;
+
+	/* Back to front, so every byte still sees its original left
+	 * neighbour */
+	for (i = len; i-- > stride; ) {
+		buf[i] -= buf[i - stride];
+	}
+}
+
+void delta_decode(uint8_t * buf, size_t len, size_t stride)
+{
+	size_t i;
+
+	for (i = stride; i < len; ++i) {
+		buf[i] += buf[i - stride];
+	}
+}
+
+/* LZ parameters: 4-byte minimum match, 64 KB window, and a 4K-entry
+ * hash table of the last position where each 4-byte sequence was seen */
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+/* Matches must leave the last bytes as literals, as in LZ4 */
+#define LZ_LAST_LITERALS 5
+
+static inline uint32_t lz_read32(const uint8_t * p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/* Write a length of at least 15 as extra bytes after the token */
+static uint8_t * lz_put_length(uint8_t * op, size_t len)
+{
+	len -= 15;
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+static uint8_t * lz_put_sequence(uint8_t * op, const uint8_t * lit, size_t lit_len,
+				 size_t offset, size_t match_len)
+{
+	uint8_t * token = op++;
+	size_t ml = match_len ? match_len - LZ_MIN_MATCH : 0;
+
+	*token = (uint8_t)(((lit_len < 15 ? lit_len : 15) << 4) | (ml < 15 ? ml : 15));
+	if (lit_len >= 15) {
+		op = lz_put_length(op, lit_len);
+	}
+	memcpy(op, lit, lit_len);
+	op += lit_len;
+
+	if (match_len) {
+		*op++ = offset & 0xff;
+		*op++ = offset >> 8;
+		if (ml >= 15) {
+			op = lz_put_length(op, ml);
+		}
+	}
+
+	return op;
+}
+
+size_t lz_compress(const uint8_t * src, size_t len, uint8_t * dst)
+{
+	uint32_t table[1 << LZ_HASH_BITS];
+	const uint8_t * anchor = src;
+	const uint8_t * end = src + len;
+	const uint8_t * limit = len > LZ_LAST_LITERALS + LZ_MIN_MATCH ?
+		end - LZ_LAST_LITERALS - LZ_MIN_MATCH : src;
+	const uint8_t * ip = src;
+	uint8_t * op = dst;
+
+	memset(table, 0xff, sizeof(table));
+
+	while (ip < limit) {
+		uint32_t seq = lz_read32(ip);
+		uint32_t h = lz_hash(seq);
+		uint32_t cand = table[h];
+		table[h] = (uint32_t)(ip - src);
+
+		if (cand != 0xffffffffU && (size_t)(ip - src) - cand <= LZ_MAX_OFFSET &&
+		    lz_read32(src + cand) == seq) {
+			const uint8_t * match = src + cand;
+			size_t ml = LZ_MIN_MATCH;
+
+			while (ip + ml < end - LZ_LAST_LITERALS && ip[ml] == match[ml]) {
+				++ml;
+			}
+
+			op = lz_put_sequence(op, anchor, ip - anchor, ip - match, ml);
+			ip += ml;
+			anchor = ip;
+			continue;
+		}
+		++ip;
+	}
+
+	/* Everything left is literals */
+	op = lz_put_sequence(op, anchor, end - anchor, 0, 0);
+	return op - dst;
+}
+
+/* Read an extended length; returns 1 if the input runs out */
+static int lz_get_length(const uint8_t ** ip, const uint8_t * end, size_t * len)
+{
+	uint8_t b;
+
+	do {
+		if (*ip >= end) {
+			return 1;
+		}
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+
+	return 0;
+}
+
+int lz_decompress(const uint8_t * src, size_t len, uint8_t * dst, size_t dst_len)
+{
+	const uint8_t * ip = src;
+	const uint8_t * end = src + len;
+	uint8_t * op = dst;
+	uint8_t * oend = dst + dst_len;
+
+	while (ip < end) {
+		uint8_t token = *ip++;
+		size_t lit = token >> 4, ml = token & 15, offset, i;
+
+		if (lit == 15 && lz_get_length(&ip, end, &lit)) {
+			return 1;
+		}
+		if (lit > (size_t)(end - ip) || lit > (size_t)(oend - op)) {
+			return 1;
+		}
+		memcpy(op, ip, lit);
+		ip += lit;
+		op += lit;
+
+		/* The last sequence has no match */
+		if (ip == end) {
+			break;
+		}
+
+		if (end - ip < 2) {
+			return 1;
+		}
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (ml == 15 && lz_get_length(&ip, end, &ml)) {
+			return 1;
+		}
+		ml += LZ_MIN_MATCH;
+
+		if (offset == 0 || offset > (size_t)(op - dst) || ml > (size_t)(oend - op)) {
+			return 1;
+		}
+
+		/* Byte by byte: the match may overlap what it produces */
+		for (i = 0; i < ml; ++i) {
+			op[i] = op[i - offset];
+		}
+		op += ml;
+	}
+
+	return op != oend;
+}
@@ -0,0 +1,62 @@
+/*******************************************************************************
+* Image Wire Codec Library (header)
+*
+* Description:
+*     Encodings used to ship images over the socket in fewer bytes than
+*     the raw 4-byte pixels:
+*     - RGB: pixels packed to 3 bytes, dropping the top byte, which is
+*       zero for every image we load. Only used if it really is zero.
+*     - LZ: the RGB stream, delta-coded against the pixel on the left,
+*       then compressed with a small LZ4-style byte codec.
+*
+* Creation Date:
+*     October 19, 2026
+*
+* Notes:
+*     The LZ block format follows LZ4: a token whose high nibble is the
+*     literal count and low nibble the match length minus 4 (15 meaning
+*     "more length bytes follow"), the literals, then a 16-bit little
+*     endian offset. The last sequence has literals only.
+*
+*******************************************************************************/
+
+#ifndef __CODECLIB_H__
+#define __CODECLIB_H__
+/* DO NOT WRITE ANY CODE ABOVE THIS LINE */
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Wire encodings of an image payload */
+enum img_encoding {
+	IMG_ENC_RAW = 0,
+	IMG_ENC_RGB,
+	IMG_ENC_LZ,
+	IMG_ENC_COUNT
+};
+
+/* Pack <count> pixels to 3 bytes each. Returns 0 on success, 1 if a
+ * pixel has a non-zero top byte (and <out> is then incomplete). */
+int rgb_pack(const uint32_t * pixels, size_t count, uint8_t * out);
+
+/* Inverse of rgb_pack */
+void rgb_unpack(const uint8_t * in, size_t count, uint32_t * pixels);
+
+/* Replace every byte with its difference from the byte <stride>
+ * positions earlier, and back */
+void delta_encode(uint8_t * buf, size_t len, size_t stride);
+void delta_decode(uint8_t * buf, size_t len, size_t stride);
+
+/* Largest output of lz_compress for <len> input bytes */
+#define LZ_BOUND(len) ((len) + (len) / 255 + 16)
+
+/* Compress <len> bytes into <dst>, which must hold LZ_BOUND(len)
+ * bytes. Returns the compressed size. */
+size_t lz_compress(const uint8_t * src, size_t len, uint8_t * dst);
+
+/* Decompress into exactly <dst_len> bytes. Returns 0 on success, 1 if
+ * the input is malformed. */
+int lz_decompress(const uint8_t * src, size_t len, uint8_t * dst, size_t dst_len);
+
+/* DO NOT WRITE ANY CODE BEYOND THIS LINE*/
+#endif
@@ -58,7 +58,8 @@ enum img_opcode {
     IMG_SHARPEN,
     IMG_VERTEDGES,
     IMG_HORIZEDGES,
-    IMG_RETRIEVE
+    IMG_RETRIEVE,
+    IMG_HELLO
 };
 
 /* String version of the opcodes */
@@ -70,13 +71,23 @@ const char * __opcode_strings [] = {
     "IMG_SHARPEN",
     "IMG_VERTEDGES",
     "IMG_HORIZEDGES",
-    "IMG_RETRIEVE"
+    "IMG_RETRIEVE",
+    "IMG_HELLO"
 };
 
 /* Handy macro to render an opcode as a string */
 #define OPCODE_TO_STRING(opcode)		\
     (__opcode_strings[opcode])
 
+/* To get RETRIEVE replies in other encodings than raw, a client
+ * sends an IMG_HELLO request before any other, with img_id set to
+ * the mask of IMG_ENC_BIT(enum img_encoding) it accepts. The server
+ * answers with the mask it will use in response.img_id. Without a
+ * hello, as with older clients, replies stay raw. */
+#define IMG_ENC_BIT(enc) (1 << (enc))
+#define IMG_ENC_ACCEPTS(accept, enc)					\
+	((enc) == IMG_ENC_RAW || ((accept) & IMG_ENC_BIT(enc)))
+
 /* Request payload as sent by the client and received by the
  * server. */
 struct request {
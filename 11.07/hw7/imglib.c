@@ -588,33 +588,96 @@ uint8_t saveBMP(const char* filename, const struct image* img) {
  * @return 0 on success, 1 on error.
  */
 uint8_t sendImage(struct image* img, int sockfd) {
-    char magic[3] = {'I', 'M', 'G'};
-    size_t to_send = img->width * img->height * sizeof(uint32_t);
-    char * bufptr = (char *)(img->pixels);
+	return sendImageEncoded(img, sockfd, IMG_ENC_RAW);
+}
 
-    /* Send the magic bytes */
-    if (send(sockfd, magic, 3, 0) != 3) {
-        return 1;
-    }
+/* Send exactly <len> bytes, returns 0 on success */
+static int send_all(int sockfd, const void * buf, size_t len) {
+	const char * ptr = (const char *)buf;
+	while (len) {
+		ssize_t cur = send(sockfd, ptr, len, 0);
+		if (cur <= 0) {
+			perror("Unable to send image on socket");
+			return 1;
+		}
+		ptr += cur;
+		len -= cur;
+	}
+	return 0;
+}
 
-    /* Send the width and height */
-    if (send(sockfd, &(img->width), sizeof(img->width), 0) != sizeof(img->width) ||
-        send(sockfd, &(img->height), sizeof(img->height), 0) != sizeof(img->height)) {
-        return 1;
-    }
+/* Receive exactly <len> bytes, returns 0 on success */
+static int recv_all(int sockfd, void * buf, size_t len) {
+	char * ptr = (char *)buf;
+	while (len) {
+		ssize_t cur = recv(sockfd, ptr, len, 0);
+		if (cur <= 0) {
+			return 1;
+		}
+		ptr += cur;
+		len -= cur;
+	}
+	return 0;
+}
 
-    /* Send all the pixel data on the socket */
-    while (to_send) {
-	    size_t cur = send(sockfd, bufptr, to_send, 0);
-	    if (cur <= 0) {
-		    perror("Unable to send image on socket");
-		    return 1;
-	    }
-	    bufptr += cur;
-	    to_send -= cur;
-    }
+/**
+ * sendImageEncoded - Send an image in one of the wire encodings of
+ * codeclib.h, falling back to a simpler one when it does not apply.
+ */
+uint8_t sendImageEncoded(struct image* img, int sockfd, int enc) {
+	size_t count = (size_t)img->width * img->height;
+	char header[3 + 3 * sizeof(uint32_t)];
+	size_t header_len = 3 + 2 * sizeof(uint32_t);
+	const void * payload = img->pixels;
+	size_t payload_len = count * sizeof(uint32_t);
+	uint8_t * packed = NULL, * compressed = NULL;
+	uint8_t ret;
+
+	memcpy(header, "IMG", 3);
+	memcpy(header + 3, &img->width, sizeof(uint32_t));
+	memcpy(header + 3 + sizeof(uint32_t), &img->height, sizeof(uint32_t));
+
+	if (enc != IMG_ENC_RAW && count) {
+		packed = (uint8_t *)malloc(3 * count);
+		if (!packed || rgb_pack(img->pixels, count, packed)) {
+			/* Out of memory or uses the top byte, keep it raw */
+			enc = IMG_ENC_RAW;
+		} else {
+			memcpy(header, "IM3", 3);
+			payload = packed;
+			payload_len = 3 * count;
+		}
+	}
 
-    return 0;
+	if (enc == IMG_ENC_LZ && count) {
+		compressed = (uint8_t *)malloc(LZ_BOUND(3 * count));
+	}
+
+	/* Without the buffer, the packed pixels go as they are */
+	if (compressed) {
+		uint32_t compressed_len;
+
+		/* Neighbouring pixels are similar, their differences
+		 * repeat much more than the pixels themselves */
+		delta_encode(packed, 3 * count, 3);
+		compressed_len = lz_compress(packed, 3 * count, compressed);
+
+		if (compressed_len < 3 * count) {
+			memcpy(header, "IMZ", 3);
+			memcpy(header + header_len, &compressed_len, sizeof(uint32_t));
+			header_len += sizeof(uint32_t);
+			payload = compressed;
+			payload_len = compressed_len;
+		} else {
+			delta_decode(packed, 3 * count, 3);
+		}
+	}
+
+	ret = send_all(sockfd, header, header_len) || send_all(sockfd, payload, payload_len);
+
+	free(packed);
+	free(compressed);
+	return ret;
 }
 
 /**
@@ -631,6 +694,75 @@ uint8_t sendImage(struct image* img, int sockfd) {
  * @return a valid image pointer on success, NULL on error.
  */
 struct image * recvImage(int sockfd) {
+	return recvImageDigest(sockfd, NULL);
+}
+
+/* Packed pixels are received and unpacked this many at a time */
+#define RECV_CHUNK_PIXELS 16384
+
+/* Receive the "IM3" (or, if <lz>, "IMZ") payload of <img>, whose
+ * header has been read already, and hash the decoded pixels into
+ * <ctx> unless it is NULL. Returns 0 on success. */
+static int recvEncodedPixels(int sockfd, struct image * img, int lz, struct md5ctx * ctx) {
+	size_t count = (size_t)img->width * img->height, done, n;
+	uint32_t compressed_len;
+	uint8_t * packed, * compressed;
+	int ret = 0;
+
+	if (!lz) {
+		/* Decode chunk by chunk as the data arrives */
+		packed = (uint8_t *)malloc(3 * RECV_CHUNK_PIXELS);
+		if (!packed) {
+			return 1;
+		}
+		for (done = 0; done < count && !ret; done += n) {
+			n = count - done < RECV_CHUNK_PIXELS ? count - done : RECV_CHUNK_PIXELS;
+			ret = recv_all(sockfd, packed, 3 * n);
+			if (!ret) {
+				rgb_unpack(packed, n, img->pixels + done);
+				if (ctx) {
+					md5_update(ctx, img->pixels + done, n * sizeof(uint32_t));
+				}
+			}
+		}
+		free(packed);
+		return ret;
+	}
+
+	/* The LZ stream only decodes as a whole */
+	if (recv_all(sockfd, &compressed_len, sizeof(uint32_t)) ||
+	    compressed_len > LZ_BOUND(3 * count)) {
+		return 1;
+	}
+	compressed = (uint8_t *)malloc(compressed_len ? compressed_len : 1);
+	packed = (uint8_t *)malloc(count ? 3 * count : 1);
+	if (!compressed || !packed) {
+		free(compressed);
+		free(packed);
+		return 1;
+	}
+
+	ret = recv_all(sockfd, compressed, compressed_len) ||
+		lz_decompress(compressed, compressed_len, packed, 3 * count);
+	if (!ret) {
+		delta_decode(packed, 3 * count, 3);
+		rgb_unpack(packed, count, img->pixels);
+		if (ctx) {
+			md5_update(ctx, img->pixels, count * sizeof(uint32_t));
+		}
+	}
+
+	free(compressed);
+	free(packed);
+	return ret;
+}
+
+/**
+ * recvImageDigest - Receive an image and, unless digest is NULL,
+ * hash its pixel bytes as they arrive.
+ */
+struct image * recvImageDigest(int sockfd, struct md5digest * digest) {
+	struct md5ctx ctx;
 	char magic[3];
 	size_t to_recv;
 	char * bufptr;
@@ -638,13 +770,15 @@ struct image * recvImage(int sockfd) {
 	struct image * img = NULL;
 
 	/* Receive the magic bytes */
-	if (recv(sockfd, magic, 3, 0) != 3 || strncmp(magic, "IMG", 3) != 0) {
+	if (recv_all(sockfd, magic, 3) ||
+	    (strncmp(magic, "IMG", 3) != 0 && strncmp(magic, "IM3", 3) != 0 &&
+	     strncmp(magic, "IMZ", 3) != 0)) {
 		return NULL;
 	}
 
 	/* Receive the width and height */
-	if (recv(sockfd, &(width), sizeof(uint32_t), 0) != sizeof(uint32_t) ||
-	    recv(sockfd, &(height), sizeof(uint32_t), 0) != sizeof(uint32_t)) {
+	if (recv_all(sockfd, &(width), sizeof(uint32_t)) ||
+	    recv_all(sockfd, &(height), sizeof(uint32_t))) {
 		return NULL;
 	}
 
@@ -652,17 +786,35 @@ struct image * recvImage(int sockfd) {
 	img = createImage(width, height);
 	to_recv = img->width * img->height * sizeof(uint32_t);
 	bufptr = (char *)(img->pixels);
+	if (digest) {
+		md5_init(&ctx);
+	}
+
+	if (magic[2] != 'G') {
+		if (recvEncodedPixels(sockfd, img, magic[2] == 'Z', digest ? &ctx : NULL)) {
+			deleteImage(img);
+			return NULL;
+		}
+		to_recv = 0;
+	}
 
 	/* Receive all the pixel bytes on the socket */
 	while(to_recv) {
-		size_t cur = recv(sockfd, bufptr, to_recv, 0);
+		ssize_t cur = recv(sockfd, bufptr, to_recv, 0);
 		if (cur <= 0) {
 			deleteImage(img);
 			return NULL;
 		}
+		if (digest) {
+			md5_update(&ctx, bufptr, cur);
+		}
 		bufptr += cur;
 		to_recv -= cur;
 	}
 
+	if (digest) {
+		*digest = md5_final(&ctx);
+	}
+
 	return img;
 }
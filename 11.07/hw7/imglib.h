@@ -39,6 +39,9 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include "md5sum.h"
+#include "codeclib.h"
+
 struct image {
 	uint32_t width; /* The width of the image */
 	uint32_t height; /* The height of the image */
@@ -242,6 +245,23 @@ uint8_t saveBMP(const char* filename, const struct image* img);
  */
 uint8_t sendImage(struct image* img, int sockfd);
 
+/**
+ * sendImageEncoded - Like sendImage, but with the pixel data in a
+ * smaller wire encoding (see codeclib.h):
+ *   - IMG_ENC_RAW: same as sendImage.
+ *   - IMG_ENC_RGB: magic "IM3", width, height, then 3 bytes per pixel.
+ *   - IMG_ENC_LZ:  magic "IMZ", width, height, 4 bytes of compressed
+ *     length, then the LZ-compressed, delta-coded 3-byte pixels.
+ * Images whose pixels do not fit in 3 bytes are sent raw, and LZ data
+ * that does not shrink is sent as "IM3".
+ *
+ * @param img Pointer to the image structure to be sent.
+ * @param sockfd The socket descriptor to send data over.
+ * @param enc One of enum img_encoding.
+ * @return 0 on success, 1 on error.
+ */
+uint8_t sendImageEncoded(struct image* img, int sockfd, int enc);
+
 /**
  * recvImage - Deserialize and receive an image structure over a given socket.
  *
@@ -257,5 +277,20 @@ uint8_t sendImage(struct image* img, int sockfd);
  */
 struct image * recvImage(int sockfd);
 
+/**
+ * recvImageDigest - Like recvImage, but also compute the MD5 digest of
+ * the pixel data while it is being received.
+ *
+ * Each chunk is hashed right after recv() returns it, while it is
+ * still in cache, so no second pass over the image is needed.
+ * Both recvImage and recvImageDigest accept every encoding produced by
+ * sendImageEncoded; the digest is always that of the decoded pixels.
+ *
+ * @param sockfd The socket descriptor to receive data from.
+ * @param digest Filled with the MD5 of the pixel bytes on success.
+ * @return a valid image pointer on success, NULL on error.
+ */
+struct image * recvImageDigest(int sockfd, struct md5digest * digest);
+
 /* DO NOT WRITE ANY CODE BEYOND THIS LINE*/
 #endif
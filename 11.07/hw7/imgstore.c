@@ -0,0 +1,367 @@
+/*******************************************************************************
+* Persistent Image Store (implementation)
+*
+* Description:
+*     Append-only segment files of image frames plus an id index. See
+*     imgstore.h for the overview.
+*
+* Creation Date:
+*     October 19, 2026
+*
+* Notes:
+*     Startup trusts the index only as far as the frames it points to
+*     check out; anything written after the last good index entry (a
+*     crash between writing a frame and its entry) is found by scanning
+*     the frame headers, and a torn frame at the end of the last
+*     segment is cut off.
+*
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "imgstore.h"
+
+#define SEGMENT_FMT "%s/segment-%06u.img"
+#define INDEX_FMT "%s/index.idx"
+
+/* A frame found while loading */
+struct found_frame {
+	uint64_t img_id;
+	uint64_t seq;
+	struct imgstore_frame * frame;
+};
+
+static uint64_t frame_size(uint32_t width, uint32_t height)
+{
+	uint64_t len = sizeof(struct imgstore_frame) + (uint64_t)width * height * sizeof(uint32_t);
+	return (len + IMGSTORE_ALIGN - 1) & ~(uint64_t)(IMGSTORE_ALIGN - 1);
+}
+
+/* Return the frame at <offset> of mapped segment <map> if it is
+ * complete and well formed, NULL otherwise */
+static struct imgstore_frame * frame_at(struct imgstore_map * map, uint64_t offset)
+{
+	struct imgstore_frame * frame;
+
+	if (offset % IMGSTORE_ALIGN || offset + sizeof(*frame) > map->size) {
+		return NULL;
+	}
+
+	frame = (struct imgstore_frame *)(map->base + offset);
+	if (memcmp(frame->magic, "IMG", 4) ||
+	    offset + frame_size(frame->width, frame->height) > map->size) {
+		return NULL;
+	}
+
+	return frame;
+}
+
+static int segment_filter(const struct dirent * ent)
+{
+	unsigned int no;
+	char tail;
+	return sscanf(ent->d_name, "segment-%6u.im%c", &no, &tail) == 2 && tail == 'g';
+}
+
+static int cmp_seq(const void * a, const void * b)
+{
+	const struct found_frame * x = (const struct found_frame *)a;
+	const struct found_frame * y = (const struct found_frame *)b;
+	return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+static int open_segment(struct imgstore * store, uint32_t seg_no)
+{
+	char path[4096];
+
+	snprintf(path, sizeof(path), SEGMENT_FMT, store->dir, seg_no);
+	store->seg_fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (store->seg_fd < 0) {
+		perror(path);
+		return -1;
+	}
+	store->seg_no = seg_no;
+	store->seg_off = lseek(store->seg_fd, 0, SEEK_END);
+	return 0;
+}
+
+long imgstore_open(struct imgstore * store, const char * dir,
+		   imgstore_load_fn load, void * arg)
+{
+	struct dirent ** ents = NULL;
+	struct found_frame * found = NULL;
+	struct imgstore_entry * index = NULL;
+	uint64_t * indexed_end;
+	size_t found_count = 0, found_cap = 0, index_len = 0, i, j;
+	char path[4096];
+	struct stat st;
+	long loaded = 0;
+	int n;
+
+	memset(store, 0, sizeof(*store));
+	store->dir = strdup(dir);
+	store->seg_fd = -1;
+	store->index_fd = -1;
+	pthread_mutex_init(&store->lock, NULL);
+
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		perror(dir);
+		return -1;
+	}
+
+	/* Map every segment, in order. Segment numbers must be dense. */
+	n = scandir(dir, &ents, segment_filter, alphasort);
+	if (n < 0) {
+		perror(dir);
+		return -1;
+	}
+
+	store->maps = (struct imgstore_map *)calloc(n + 1, sizeof(struct imgstore_map));
+	indexed_end = (uint64_t *)calloc(n + 1, sizeof(uint64_t));
+	for (i = 0; i < (size_t)n; ++i) {
+		int fd;
+
+		snprintf(path, sizeof(path), SEGMENT_FMT, dir, (unsigned)i);
+		fd = open(path, O_RDONLY);
+		if (fd < 0 || fstat(fd, &st) < 0) {
+			fprintf(stderr, "WARNING: image store segment %s missing, ignoring the rest\n", path);
+			if (fd >= 0) {
+				close(fd);
+			}
+			break;
+		}
+
+		store->maps[i].size = st.st_size;
+		if (st.st_size > 0) {
+			/* Private and writable: the image operations treat
+			 * pixels as their own, and any write stays in memory */
+			store->maps[i].base = (char *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+							   MAP_PRIVATE, fd, 0);
+			if (store->maps[i].base == MAP_FAILED) {
+				perror(path);
+				close(fd);
+				break;
+			}
+		}
+		close(fd);
+		store->map_count++;
+	}
+	for (j = 0; j < (size_t)n; ++j) {
+		free(ents[j]);
+	}
+	free(ents);
+
+	/* Read the index and keep the entries whose frame checks out */
+	snprintf(path, sizeof(path), INDEX_FMT, dir);
+	store->index_fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (store->index_fd < 0 || fstat(store->index_fd, &st) < 0) {
+		perror(path);
+		return -1;
+	}
+
+	index_len = st.st_size / sizeof(struct imgstore_entry);
+	if (index_len) {
+		index = (struct imgstore_entry *)malloc(index_len * sizeof(struct imgstore_entry));
+		if (pread(store->index_fd, index, index_len * sizeof(struct imgstore_entry), 0)
+		    != (ssize_t)(index_len * sizeof(struct imgstore_entry))) {
+			perror(path);
+			index_len = 0;
+		}
+	}
+
+	for (i = 0; i < index_len; ++i) {
+		struct imgstore_frame * frame;
+
+		if (index[i].segment >= store->map_count) {
+			continue;
+		}
+		frame = frame_at(&store->maps[index[i].segment], index[i].offset);
+		if (!frame || frame->img_id != index[i].img_id) {
+			continue;
+		}
+
+		if (found_count == found_cap) {
+			found_cap = found_cap ? 2 * found_cap : 1024;
+			found = (struct found_frame *)realloc(found, found_cap * sizeof(*found));
+		}
+		found[found_count].img_id = frame->img_id;
+		found[found_count].seq = frame->seq;
+		found[found_count].frame = frame;
+		found_count++;
+
+		uint64_t end = index[i].offset + frame_size(frame->width, frame->height);
+		if (end > indexed_end[index[i].segment]) {
+			indexed_end[index[i].segment] = end;
+		}
+	}
+	free(index);
+
+	/* Pick up frames written after their index entry was lost. Only
+	 * headers are read: the pixels are skipped over. */
+	for (i = 0; i < store->map_count; ++i) {
+		uint64_t off = indexed_end[i];
+		struct imgstore_frame * frame;
+
+		while ((frame = frame_at(&store->maps[i], off)) != NULL) {
+			struct imgstore_entry entry = { frame->img_id, (uint32_t)i, 0, off };
+
+			if (found_count == found_cap) {
+				found_cap = found_cap ? 2 * found_cap : 1024;
+				found = (struct found_frame *)realloc(found, found_cap * sizeof(*found));
+			}
+			found[found_count].img_id = frame->img_id;
+			found[found_count].seq = frame->seq;
+			found[found_count].frame = frame;
+			found_count++;
+
+			if (write(store->index_fd, &entry, sizeof(entry)) != sizeof(entry)) {
+				perror("Unable to repair image store index");
+			}
+			off += frame_size(frame->width, frame->height);
+		}
+		indexed_end[i] = off;
+	}
+
+	/* Replay in write order, so that the latest frame of an id wins */
+	qsort(found, found_count, sizeof(*found), cmp_seq);
+	for (i = 0; i < found_count; ++i) {
+		struct image * img = (struct image *)malloc(sizeof(struct image));
+
+		img->width = found[i].frame->width;
+		img->height = found[i].frame->height;
+		img->pixels = (uint32_t *)(found[i].frame + 1);
+		load(found[i].img_id, img, arg);
+		loaded++;
+
+		if (found[i].seq >= store->next_seq) {
+			store->next_seq = found[i].seq + 1;
+		}
+	}
+	free(found);
+
+	/* Continue appending to the last segment, past its last good
+	 * frame; a torn frame after it is cut off */
+	if (open_segment(store, store->map_count ? store->map_count - 1 : 0) < 0) {
+		free(indexed_end);
+		return -1;
+	}
+	if (store->map_count && store->seg_off > indexed_end[store->map_count - 1]) {
+		store->seg_off = indexed_end[store->map_count - 1];
+		if (ftruncate(store->seg_fd, store->seg_off) < 0) {
+			perror("Unable to truncate image store segment");
+		}
+	}
+	free(indexed_end);
+
+	return loaded;
+}
+
+int imgstore_append(struct imgstore * store, uint64_t img_id, const struct image * img)
+{
+	struct imgstore_frame frame;
+	struct imgstore_entry entry;
+	static const char zeros[IMGSTORE_ALIGN];
+	uint64_t size = frame_size(img->width, img->height);
+	uint64_t pixels = (uint64_t)img->width * img->height * sizeof(uint32_t);
+	struct iovec iov[3];
+	ssize_t expected = size, written;
+	int fd;
+
+	memset(&frame, 0, sizeof(frame));
+	memcpy(frame.magic, "IMG", 4);
+	frame.width = img->width;
+	frame.height = img->height;
+	frame.img_id = img_id;
+
+	/* Reserve room for the frame; the copy itself runs unlocked */
+	pthread_mutex_lock(&store->lock);
+	if (store->seg_off && store->seg_off + size > IMGSTORE_SEGMENT_SIZE) {
+		close(store->seg_fd);
+		if (open_segment(store, store->seg_no + 1) < 0) {
+			pthread_mutex_unlock(&store->lock);
+			return -1;
+		}
+	}
+	frame.seq = store->next_seq++;
+	entry.img_id = img_id;
+	entry.segment = store->seg_no;
+	entry.reserved = 0;
+	entry.offset = store->seg_off;
+	store->seg_off += size;
+	fd = dup(store->seg_fd);
+	pthread_mutex_unlock(&store->lock);
+
+	iov[0].iov_base = &frame;
+	iov[0].iov_len = sizeof(frame);
+	iov[1].iov_base = img->pixels;
+	iov[1].iov_len = pixels;
+	iov[2].iov_base = (void *)zeros;
+	iov[2].iov_len = size - sizeof(frame) - pixels;
+
+	written = pwritev(fd, iov, 3, entry.offset);
+	close(fd);
+	if (written != expected) {
+		perror("Unable to write image to store");
+		return -1;
+	}
+
+	/* Small O_APPEND writes do not interleave */
+	if (write(store->index_fd, &entry, sizeof(entry)) != sizeof(entry)) {
+		perror("Unable to write image store index");
+		return -1;
+	}
+
+	return 0;
+}
+
+void imgstore_release(struct imgstore * store, struct image * img)
+{
+	uint32_t i;
+
+	if (!img) {
+		return;
+	}
+
+	for (i = 0; store && i < store->map_count; ++i) {
+		char * p = (char *)img->pixels;
+		if (p >= store->maps[i].base && p < store->maps[i].base + store->maps[i].size) {
+			free(img);
+			return;
+		}
+	}
+
+	deleteImage(img);
+}
+
+void imgstore_close(struct imgstore * store)
+{
+	uint32_t i;
+
+	for (i = 0; i < store->map_count; ++i) {
+		if (store->maps[i].size) {
+			munmap(store->maps[i].base, store->maps[i].size);
+		}
+	}
+	free(store->maps);
+	store->maps = NULL;
+	store->map_count = 0;
+
+	if (store->seg_fd >= 0) {
+		close(store->seg_fd);
+	}
+	if (store->index_fd >= 0) {
+		close(store->index_fd);
+	}
+	free(store->dir);
+	pthread_mutex_destroy(&store->lock);
+}
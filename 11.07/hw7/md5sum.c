@@ -55,10 +55,15 @@
 
 typedef struct MD5state
 {
-	uint len;
+	ulong len;
 	uint state[4];
 } MD5state;
 
+/* Initial value of the MD5 state */
+static const uint md5_seed[4] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+};
+
 /*
  *	Rotate amounts used in the algorithm
  */
@@ -212,59 +217,24 @@ static void decode(uint *output, byte *input, uint len)
 }
 
 /*
- *  I require len to be a multiple of 64 for all but
- *  the last call
+ *	Run the compression function over nblocks 64-byte blocks,
+ *	reading them directly from p
  */
-static MD5state* md5(byte *p, uint len, byte *digest, MD5state *s)
+static void md5_blocks(uint state[4], const byte *p, size_t nblocks)
 {
 	uint a, b, c, d, tmp;
-	uint i, done;
+	uint i;
 	Table *t;
-	byte *end;
+	const byte *end;
 	uint x[16];
 
-	if(s == NULL){
-		s = calloc(sizeof(*s),1);
-		if(s == NULL)
-			return NULL;
-
-		/* seed the state, these constants would look nicer big-endian */
-		s->state[0] = 0x67452301;
-		s->state[1] = 0xefcdab89;
-		s->state[2] = 0x98badcfe;
-		s->state[3] = 0x10325476;
-	}
-	s->len += len;
-
-	i = len & 0x3f;
-	if(i || len == 0){
-		done = 1;
-
-		/* pad the input, assume there's room */
-		if(i < 56)
-			i = 56 - i;
-		else
-			i = 120 - i;
-		if(i > 0){
-			memset(p + len, 0, i);
-			p[len] = 0x80;
-		}
-		len += i;
-
-		/* append the count */
-		x[0] = s->len<<3;
-		x[1] = s->len>>29;
-		encode(p+len, x, 8);
-	} else
-		done = 0;
-
-	for(end = p+len; p < end; p += 64){
-		a = s->state[0];
-		b = s->state[1];
-		c = s->state[2];
-		d = s->state[3];
+	for(end = p + 64*nblocks; p < end; p += 64){
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
 
-		decode(x, p, 64);
+		decode(x, (byte *)p, 64);
 
 		for(i = 0; i < 64; i++){
 			t = tab + i;
@@ -294,14 +264,64 @@ static MD5state* md5(byte *p, uint len, byte *digest, MD5state *s)
 			a = tmp;
 		}
 
-		s->state[0] += a;
-		s->state[1] += b;
-		s->state[2] += c;
-		s->state[3] += d;
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+	}
+}
+
+/*
+ *	Build the padded last one or two blocks of a message of
+ *	total bytes, whose last len % 64 bytes start at tail. Returns
+ *	the number of blocks written to out (which holds 128 bytes).
+ */
+static uint md5_pad(byte out[128], const byte *tail, ulong total)
+{
+	uint rem = total & 0x3f;
+	uint nblocks = (rem < 56) ? 1 : 2;
+	uint x[2];
+
+	memcpy(out, tail, rem);
+	memset(out + rem, 0, 64*nblocks - rem);
+	out[rem] = 0x80;
+
+	/* append the count */
+	x[0] = total<<3;
+	x[1] = total>>29;
+	encode(out + 64*nblocks - 8, x, 8);
+
+	return nblocks;
+}
+
+/*
+ *  I require len to be a multiple of 64 for all but
+ *  the last call
+ */
+static MD5state* md5(byte *p, uint len, byte *digest, MD5state *s)
+{
+	byte last[128];
+	uint n;
+
+	if(s == NULL){
+		s = calloc(sizeof(*s),1);
+		if(s == NULL)
+			return NULL;
+
+		/* seed the state, these constants would look nicer big-endian */
+		memcpy(s->state, md5_seed, sizeof(md5_seed));
 	}
+	s->len += len;
 
-	/* return result */
-	if(done){
+	md5_blocks(s->state, p, len >> 6);
+
+	if((len & 0x3f) || len == 0 || digest != NULL){
+		if(digest == NULL)
+			return s;
+		n = md5_pad(last, p + (len & ~0x3f), s->len);
+		md5_blocks(s->state, last, n);
+
+		/* return result */
 		encode(digest, s->state, 16);
 		free(s);
 		return NULL;
@@ -309,25 +329,211 @@ static MD5state* md5(byte *p, uint len, byte *digest, MD5state *s)
 	return s;
 }
 
-struct md5digest buf_md5sum(const char * orig_buf, size_t len)
+void md5_init(struct md5ctx * ctx)
+{
+	ctx->len = 0;
+	memcpy(ctx->state, md5_seed, sizeof(md5_seed));
+}
+
+/* Complete a partial block first, then hash whole blocks straight
+ * from the caller's data, and keep what is left for next time */
+void md5_update(struct md5ctx * ctx, const void * data, size_t len)
+{
+	const byte *p = (const byte *)data;
+	uint have = ctx->len & 0x3f;
+	uint take;
+
+	ctx->len += len;
+
+	if(have){
+		take = 64 - have;
+		if(take > len)
+			take = len;
+		memcpy(ctx->buf + have, p, take);
+		p += take;
+		len -= take;
+		if(have + take < 64)
+			return;
+		md5_blocks(ctx->state, ctx->buf, 1);
+	}
+
+	md5_blocks(ctx->state, p, len >> 6);
+	memcpy(ctx->buf, p + (len & ~(size_t)0x3f), len & 0x3f);
+}
+
+struct md5digest md5_final(struct md5ctx * ctx)
 {
 	struct md5digest digest;
-	MD5state * s = NULL;
+	byte last[128];
+	uint n;
 
-	byte * buf = calloc(1, len + 256);
-	memcpy(buf, orig_buf, len);
+	n = md5_pad(last, ctx->buf, ctx->len);
+	md5_blocks(ctx->state, last, n);
 
-	/* For the first call, n must be a multiple of 64 */
-	size_t n = (len >> 6) << 6;
-	s = md5(buf, n, NULL, s);
+	encode(digest.__digest, ctx->state, 16);
+	return digest;
+}
 
-	/* Set n to the remainder, potentially 0 */
-	md5(buf+n, len % 64, digest.__digest, s);
+/* Hash a buffer in place: the full blocks are read from the
+ * caller's memory and only the tail is copied, to be padded */
+struct md5digest buf_md5sum(const char * orig_buf, size_t len)
+{
+	struct md5digest digest;
+	uint state[4];
+	byte last[128];
+	uint n;
 
-	free(buf);
+	memcpy(state, md5_seed, sizeof(md5_seed));
+	md5_blocks(state, (const byte *)orig_buf, len >> 6);
+	n = md5_pad(last, (const byte *)orig_buf + (len & ~(size_t)0x3f), len);
+	md5_blocks(state, last, n);
+
+	encode(digest.__digest, state, 16);
 	return digest;
 }
 
+/*
+ *	Multi-buffer MD5. MD5 is a serial chain within one message, so
+ *	SIMD cannot speed up a single hash; instead MD5_LANES messages
+ *	are hashed side by side, lane i of every vector register
+ *	carrying the state of message i. GCC vector extensions keep
+ *	the code portable; target_clones builds an AVX2 version (one
+ *	8-lane vector) next to the baseline SSE2 one (two 4-lane halves)
+ *	and picks the right one at load time.
+ */
+typedef uint v8u __attribute__((vector_size(4 * MD5_LANES)));
+
+#define ROTL(v, r)	(((v) << (r)) | ((v) >> (32 - (r))))
+
+struct md5_lane
+{
+	const byte *buf;	/* message */
+	size_t nfull;		/* full 64-byte blocks in buf */
+	size_t nblocks;		/* including the padded ones */
+	byte last[128];		/* padded tail */
+};
+
+static inline const byte* lane_block(struct md5_lane *l, size_t i)
+{
+	return (i < l->nfull) ? l->buf + 64*i : l->last + 64*(i - l->nfull);
+}
+
+__attribute__((target_clones("avx2", "default")))
+static void md5_lanes(struct md5_lane *lanes, uint states[MD5_LANES][4])
+{
+	v8u a, b, c, d, aa, bb, cc, dd, f, tmp;
+	v8u x[16], active;
+	size_t maxblocks = 0, blk;
+	uint i, l, k;
+	Table *t;
+
+	for(l = 0; l < MD5_LANES; l++){
+		if(lanes[l].nblocks > maxblocks)
+			maxblocks = lanes[l].nblocks;
+		for(k = 0; k < 4; k++)
+			states[l][k] = md5_seed[k];
+	}
+
+	for(k = 0; k < MD5_LANES; k++){
+		a[k] = states[k][0];
+		b[k] = states[k][1];
+		c[k] = states[k][2];
+		d[k] = states[k][3];
+	}
+
+	for(blk = 0; blk < maxblocks; blk++){
+		/* Transpose: word k of every lane's block into x[k]. Lanes
+		 * that are done hash a copy of their last block, and the
+		 * result is masked out below. */
+		for(l = 0; l < MD5_LANES; l++){
+			const byte *p;
+			uint w[16];
+
+			active[l] = (blk < lanes[l].nblocks) ? 0xffffffff : 0;
+			p = lane_block(&lanes[l], active[l] ? blk : lanes[l].nblocks - 1);
+			memcpy(w, p, 64);	/* little-endian, like decode() */
+			for(k = 0; k < 16; k++)
+				x[k][l] = w[k];
+		}
+
+		aa = a; bb = b; cc = c; dd = d;
+
+		for(i = 0; i < 64; i++){
+			t = tab + i;
+			switch(i>>4){
+			case 0:
+				f = (b & c) | (~b & d);
+				break;
+			case 1:
+				f = (b & d) | (c & ~d);
+				break;
+			case 2:
+				f = b ^ c ^ d;
+				break;
+			default:
+				f = c ^ (b | ~d);
+				break;
+			}
+			a += f + x[t->x] + t->sin;
+			a = ROTL(a, t->rot);
+			a += b;
+
+			/* rotate variables */
+			tmp = d;
+			d = c;
+			c = b;
+			b = a;
+			a = tmp;
+		}
+
+		a = aa + (a & active);
+		b = bb + (b & active);
+		c = cc + (c & active);
+		d = dd + (d & active);
+	}
+
+	for(l = 0; l < MD5_LANES; l++){
+		states[l][0] = a[l];
+		states[l][1] = b[l];
+		states[l][2] = c[l];
+		states[l][3] = d[l];
+	}
+}
+
+void buf_md5sum_multi(const char * const * bufs, const size_t * lens,
+		      struct md5digest * digests, size_t count)
+{
+	struct md5_lane lanes[MD5_LANES];
+	uint states[MD5_LANES][4];
+	size_t base, l;
+
+	for(base = 0; base < count; base += MD5_LANES){
+		size_t used = count - base < MD5_LANES ? count - base : MD5_LANES;
+
+		/* A lone message gains nothing from the lanes */
+		if(used == 1){
+			digests[base] = buf_md5sum(bufs[base], lens[base]);
+			break;
+		}
+
+		for(l = 0; l < MD5_LANES; l++){
+			/* Unused lanes hash an empty message */
+			const byte *buf = (const byte *)(l < used ? bufs[base + l] : "");
+			size_t len = l < used ? lens[base + l] : 0;
+
+			lanes[l].buf = buf;
+			lanes[l].nfull = len >> 6;
+			lanes[l].nblocks = lanes[l].nfull +
+				md5_pad(lanes[l].last, buf + (len & ~(size_t)0x3f), len);
+		}
+
+		md5_lanes(lanes, states);
+
+		for(l = 0; l < used; l++)
+			encode(digests[base + l].__digest, states[l], 16);
+	}
+}
+
 struct md5digest file_md5sum(const char *name)
 {
 	byte *buf;
@@ -58,8 +58,31 @@ struct md5digest
 /* Compute the MD5 hash of a file given its pathname */
 struct md5digest file_md5sum(const char * name);
 
-/* Compute the MD5 hash of a memory buffer */
+/* State of an MD5 computation over data that arrives in pieces */
+struct md5ctx
+{
+	uint64_t len;		/* Bytes hashed so far */
+	uint32_t state[4];
+	uint8_t buf[64];	/* Partial block not hashed yet */
+};
+
+/* Start, feed and finish an incremental MD5 computation. Pieces
+ * can have any length; feeding the same bytes in any split gives the
+ * same digest as buf_md5sum. */
+void md5_init(struct md5ctx * ctx);
+void md5_update(struct md5ctx * ctx, const void * data, size_t len);
+struct md5digest md5_final(struct md5ctx * ctx);
+
+/* Compute the MD5 hash of a memory buffer, in place */
 struct md5digest buf_md5sum(const char * orig_buf, size_t len);
 
+/* Number of messages hashed side by side by buf_md5sum_multi */
+#define MD5_LANES 8
+
+/* Compute the MD5 hashes of count memory buffers at once, MD5_LANES
+ * at a time. Digest i is the same as buf_md5sum(bufs[i], lens[i]). */
+void buf_md5sum_multi(const char * const * bufs, const size_t * lens,
+		      struct md5digest * digests, size_t count);
+
 /* DO NOT WRITE ANY CODE BEYOND THIS LINE*/
 #endif
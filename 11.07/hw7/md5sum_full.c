@@ -52,10 +52,18 @@
  */
 
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 typedef uint32_t uint;
 typedef uint8_t byte;
@@ -64,7 +72,7 @@ typedef uint8_t uchar;
 
 typedef struct MD5state
 {
-	uint len;
+	ulong len;
 	uint state[4];
 }MD5state;
 MD5state *nil;
@@ -73,13 +81,58 @@ MD5state *nil;
 
 int debug;
 int hex;    /* print in hex?  (instead of default base64) */
+int recurse;	/* descend into directories? */
+int nthreads;	/* hashing threads, default one per CPU */
+
+/*
+ *	Files are hashed by a pool of threads but printed in the order
+ *	they were named (directories in sorted order). Jobs live in a
+ *	ring of JOB_WINDOW slots: the walker blocks when the oldest
+ *	unprinted file is JOB_WINDOW behind, so memory stays bounded
+ *	however many files there are, and whichever worker completes
+ *	the oldest job prints every finished job in sequence.
+ */
+#define JOB_WINDOW	4096
+
+/* Files at least this big are mapped rather than read */
+#define MMAP_MIN	(1<<20)
+
+/* Read buffer of each worker, a multiple of 64 and of the page size */
+#define READ_BUF	(1<<20)
+
+enum { JOB_QUEUED, JOB_DONE, JOB_FAILED };
+
+typedef struct Job
+{
+	char	*name;
+	int	state;
+	int	err;
+	byte	digest[16];
+} Job;
+
+struct {
+	Job		ring[JOB_WINDOW];
+	long		produced;	/* jobs added by the walker */
+	long		claimed;	/* jobs taken by a worker */
+	long		printed;	/* jobs written out */
+	int		walk_done;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
 
 /* Helper function prototypes */
 void encode(byte*, uint*, uint);
 void decode(uint*, byte*, uint);
 MD5state* md5(byte*, uint, byte*, MD5state*);
+void md5blocks(uint*, byte*, ulong);
 void sum(FILE*, char*);
+void pr(byte*, char*);
 int enc64(char*, byte*, int);
+void walk(char*, int);
+void* worker(void*);
 
 /*
  *	Rotate amounts used in the algorithm
@@ -191,40 +244,240 @@ Table tab[] =
 
 int main(int argc, char **argv)
 {
-	int c;
-	FILE *fd;
+	int c, i;
+	pthread_t *threads;
 
 	argv++; argc--;
-	if(argc>0 && strcmp(argv[0],"-d")==0){
-		debug++;
-		argv++; argc--;
+	for(; argc>0 && argv[0][0]=='-' && argv[0][1]!=0; argv++, argc--){
+		if(strcmp(argv[0],"-d")==0)
+			debug++;
+		else if(strcmp(argv[0],"-x")==0)
+			hex++;
+		else if(strcmp(argv[0],"-r")==0)
+			recurse++;
+		else if(strcmp(argv[0],"-j")==0 && argc>1){
+			nthreads = atoi(argv[1]);
+			argv++; argc--;
+		}else{
+			fprintf(stderr, "usage: md5sum [-d] [-x] [-r] [-j threads] [file|dir ...]\n");
+			return EXIT_FAILURE;
+		}
 	}
 
-	if(argc>0 && strcmp(argv[0],"-x")==0){
-		hex++;
-		argv++; argc--;
+	if(argc == 0){
+		sum(stdin,0);
+		return EXIT_SUCCESS;
 	}
 
-	if(argc == 0)
-		sum(stdin,0);
-	else for(c = 0; c < argc; c++){
-		fd = fopen(argv[c],"r");
-		if(fd==NULL){
-			fprintf(stderr, "md5sum: can't open %s\n", argv[c]);
+	if(nthreads <= 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if(nthreads <= 0)
+		nthreads = 1;
+
+	threads = calloc(nthreads, sizeof(pthread_t));
+	for(i = 0; i < nthreads; i++)
+		pthread_create(&threads[i], NULL, worker, NULL);
+
+	for(c = 0; c < argc; c++)
+		walk(argv[c], 1);
+
+	pthread_mutex_lock(&pool.lock);
+	pool.walk_done = 1;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+
+	for(i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ *	Queue a file for hashing, waiting for room in the window
+ */
+static void addjob(char *name)
+{
+	Job *j;
+
+	pthread_mutex_lock(&pool.lock);
+	while(pool.produced - pool.printed >= JOB_WINDOW)
+		pthread_cond_wait(&pool.cond, &pool.lock);
+	j = &pool.ring[pool.produced % JOB_WINDOW];
+	j->name = name;
+	j->state = JOB_QUEUED;
+	j->err = 0;
+	pool.produced++;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+/*
+ *	Queue name, or with -r everything below it in sorted order.
+ *	Files named on the command line are queued even if they cannot
+ *	be opened, so that the error is reported in order.
+ */
+void walk(char *name, int top)
+{
+	struct stat st;
+	struct dirent **ents;
+	char *path;
+	int i, n;
+
+	if(recurse && stat(name, &st) == 0 && S_ISDIR(st.st_mode)){
+		n = scandir(name, &ents, NULL, alphasort);
+		if(n < 0){
+			fprintf(stderr, "md5sum: can't read %s\n", name);
+			return;
+		}
+		for(i = 0; i < n; i++){
+			if(strcmp(ents[i]->d_name, ".") && strcmp(ents[i]->d_name, "..")){
+				if(asprintf(&path, "%s/%s", name, ents[i]->d_name) >= 0)
+					walk(path, 0);
+			}
+			free(ents[i]);
+		}
+		free(ents);
+		if(!top)
+			free(name);
+		return;
+	}
+
+	if(!top && (lstat(name, &st) < 0 || !S_ISREG(st.st_mode))){
+		free(name);
+		return;
+	}
+	addjob(top ? strdup(name) : name);
+}
+
+/*
+ *	Hash an open file: big files are mapped and hashed in place,
+ *	small ones read into the worker's aligned buffer. Only the
+ *	tail, shorter than a block, is copied to be padded.
+ */
+static int hashfd(int fd, byte *digest, byte *buf)
+{
+	struct stat st;
+	MD5state *s;
+	byte *p, last[128];
+	ulong n;
+	ssize_t i;
+
+	if(fstat(fd, &st) < 0)
+		return errno;
+
+	/* md5() frees the state on the last call */
+	s = calloc(sizeof(*s),1);
+	if(s == nil)
+		return ENOMEM;
+	s->state[0] = 0x67452301;
+	s->state[1] = 0xefcdab89;
+	s->state[2] = 0x98badcfe;
+	s->state[3] = 0x10325476;
+
+	if(st.st_size >= MMAP_MIN){
+		p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(p != MAP_FAILED){
+			madvise(p, st.st_size, MADV_SEQUENTIAL);
+			n = st.st_size & ~(ulong)0x3f;
+			md5blocks(s->state, p, n>>6);
+			s->len = n;
+			memcpy(last, p + n, st.st_size - n);
+			munmap(p, st.st_size);
+			md5(last, st.st_size - n, digest, s);
+			return 0;
+		}
+	}
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	n = 0;
+	for(;;){
+		i = read(fd, buf+n, READ_BUF-n);
+		if(i < 0){
+			if(errno == EINTR)
+				continue;
+			free(s);
+			return errno;
+		}
+		if(i == 0)
+			break;
+		n += i;
+		if(n < READ_BUF)
 			continue;
+		md5blocks(s->state, buf, n>>6);
+		s->len += n;
+		n = 0;
+	}
+
+	/* the buffer has room past READ_BUF for the padding */
+	md5blocks(s->state, buf, n>>6);
+	s->len += n & ~(ulong)0x3f;
+	memmove(buf, buf + (n & ~(ulong)0x3f), n & 0x3f);
+	md5(buf, n & 0x3f, digest, s);
+	return 0;
+}
+
+void* worker(void *arg)
+{
+	byte *buf;
+	Job *j;
+	char *name;
+	int fd, err;
+	byte digest[16];
+
+	(void)arg;
+	if(posix_memalign((void**)&buf, 4096, READ_BUF + 128))
+		return NULL;
+
+	pthread_mutex_lock(&pool.lock);
+	for(;;){
+		while(pool.claimed == pool.produced && !pool.walk_done)
+			pthread_cond_wait(&pool.cond, &pool.lock);
+		if(pool.claimed == pool.produced)
+			break;
+		j = &pool.ring[pool.claimed++ % JOB_WINDOW];
+		name = j->name;
+		pthread_mutex_unlock(&pool.lock);
+
+		fd = open(name, O_RDONLY);
+		if(fd < 0)
+			err = errno;
+		else{
+			err = hashfd(fd, digest, buf);
+			close(fd);
 		}
-		sum(fd, argv[c]);
-		fclose(fd);
+
+		pthread_mutex_lock(&pool.lock);
+		memcpy(j->digest, digest, 16);
+		j->err = err;
+		j->state = err ? JOB_FAILED : JOB_DONE;
+
+		/* print everything that is now in order */
+		while(pool.printed < pool.produced){
+			j = &pool.ring[pool.printed % JOB_WINDOW];
+			if(j->state == JOB_QUEUED)
+				break;
+			if(j->state == JOB_FAILED)
+				fprintf(stderr, "md5sum: can't open %s: %s\n", j->name, strerror(j->err));
+			else
+				pr(j->digest, j->name);
+			free(j->name);
+			j->state = JOB_QUEUED;
+			j->name = NULL;
+			pool.printed++;
+		}
+		pthread_cond_broadcast(&pool.cond);
 	}
+	pthread_mutex_unlock(&pool.lock);
 
-	return EXIT_SUCCESS;
+	free(buf);
+	return NULL;
 }
 
 void sum(FILE *fd, char *name)
 {
 	byte *buf;
 	byte digest[16];
-	char pr64[25];
 	int i, n;
 	MD5state *s;
 
@@ -242,17 +495,25 @@ void sum(FILE *fd, char *name)
 		n = 0;
 	}
 	md5(buf, n, digest, s);
+	pr(digest, name);
+	free(buf);
+}
+
+void pr(byte *digest, char *name)
+{
+	char pr64[25];
+	int i;
+
 	if(hex){
 		for(i=0;i<16;i++) printf("%.2x", digest[i]);
 	}else{
-		enc64(pr64,digest,sizeof(digest));
+		enc64(pr64,digest,16);
 		pr64[22] = '\0';  /* chop trailing == */
 		printf("%s",pr64);
 	}
 	if(name)
 		printf("\t%s", name);
 	printf("\n");
-	free(buf);
 }
 
 /*
@@ -261,10 +522,7 @@ void sum(FILE *fd, char *name)
  */
 MD5state* md5(byte *p, uint len, byte *digest, MD5state *s)
 {
-	uint a, b, c, d, tmp;
 	uint i, done;
-	Table *t;
-	byte *end;
 	uint x[16];
 
 	if(s == nil){
@@ -299,14 +557,37 @@ MD5state* md5(byte *p, uint len, byte *digest, MD5state *s)
 		x[0] = s->len<<3;
 		x[1] = s->len>>29;
 		encode(p+len, x, 8);
+		len += 8;
 	} else
 		done = 0;
 
-	for(end = p+len; p < end; p += 64){
-		a = s->state[0];
-		b = s->state[1];
-		c = s->state[2];
-		d = s->state[3];
+	md5blocks(s->state, p, len>>6);
+
+	/* return result */
+	if(done){
+		encode(digest, s->state, 16);
+		free(s);
+		return nil;
+	}
+	return s;
+}
+
+/*
+ *	Run the compression function over n 64-byte blocks at p
+ */
+void md5blocks(uint *state, byte *p, ulong n)
+{
+	uint a, b, c, d, tmp;
+	uint i;
+	Table *t;
+	byte *end;
+	uint x[16];
+
+	for(end = p+64*n; p < end; p += 64){
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
 
 		decode(x, p, 64);
 
@@ -338,19 +619,11 @@ MD5state* md5(byte *p, uint len, byte *digest, MD5state *s)
 			a = tmp;
 		}
 
-		s->state[0] += a;
-		s->state[1] += b;
-		s->state[2] += c;
-		s->state[3] += d;
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
 	}
-
-	/* return result */
-	if(done){
-		encode(digest, s->state, 16);
-		free(s);
-		return nil;
-	}
-	return s;
 }
 
 /*
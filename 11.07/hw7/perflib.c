@@ -71,3 +71,57 @@ uint64_t read_perf_counter(int fd) {
 	read(fd, &count, sizeof(count));
 	return count;
 }
+
+/* Internally used helper to build the config value of a read-miss
+ * event on a given hardware cache */
+static uint64_t cache_read_miss(uint64_t cache)
+{
+	return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+		| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+/* Sets up a group of two performance counters tracking L1D and LLC
+ * read misses for the calling thread. On return, fds[0] is the group
+ * leader (L1D) and fds[1] the member (LLC).
+ * NOTE: this must be called from the thread you wish to monitor (i.e. the worker)
+*/
+void setup_perf_cache_counters(int fds[2]) {
+	struct perf_event_attr  pe;
+
+	// the leader is created disabled; members follow the state of the leader
+	memset(&pe, 0, sizeof(pe));
+	pe.type = PERF_TYPE_HW_CACHE;
+	pe.size = sizeof(pe);
+	pe.config = cache_read_miss(PERF_COUNT_HW_CACHE_L1D);
+	pe.disabled = 1;
+	pe.exclude_kernel = 1;
+	pe.exclude_hv = 1;
+	pe.read_format = PERF_FORMAT_GROUP;
+
+	fds[0] = perf_event_open(&pe, 0, -1, -1, 0);
+	if (fds[0] == -1) {
+		fprintf(stderr, "Error opening leader %llx\n", pe.config);
+		exit(EXIT_FAILURE);
+	}
+
+	pe.config = cache_read_miss(PERF_COUNT_HW_CACHE_LL);
+	pe.disabled = 0;
+
+	fds[1] = perf_event_open(&pe, 0, -1, fds[0], 0);
+	if (fds[1] == -1) {
+		fprintf(stderr, "Error opening group member %llx\n", pe.config);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Read both counters of a group created by setup_perf_cache_counters()
+ * with a single read() on the group leader.
+*/
+void read_perf_cache_counters(int fds[2], uint64_t * l1_misses, uint64_t * llc_misses) {
+	/* With PERF_FORMAT_GROUP the kernel returns the number of
+	 * events followed by one value per event, in creation order */
+	uint64_t values[3] = {0, 0xbeefcafeUL, 0xbeefcafeUL};
+	read(fds[0], values, sizeof(values));
+	*l1_misses = values[1];
+	*llc_misses = values[2];
+}
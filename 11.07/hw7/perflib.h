@@ -48,3 +48,16 @@ int setup_perf_counter(uint64_t type, uint64_t config);
  * NOTE: you must use a call to ioctl() to RESET/ENABLE the performance counter prior to reading.
 */
 uint64_t read_perf_counter(int fd);
+
+/* Sets up a group of two performance counters tracking L1D and LLC
+ * read misses for the calling thread. On return, fds[0] is the group
+ * leader (L1D) and fds[1] the member (LLC). RESET/ENABLE/DISABLE the
+ * whole group through the leader using PERF_IOC_FLAG_GROUP.
+ * NOTE: this must be called from the thread you wish to monitor (i.e. the worker)
+*/
+void setup_perf_cache_counters(int fds[2]);
+
+/* Read both counters of a group created by setup_perf_cache_counters()
+ * with a single read() on the group leader.
+*/
+void read_perf_cache_counters(int fds[2], uint64_t * l1_misses, uint64_t * llc_misses);
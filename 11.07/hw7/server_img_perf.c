@@ -10,13 +10,25 @@
 *     size.
 *
 * Usage:
-*     <build directory>/server -q <queue_size> -w <workers> -p <policy> <port_number>
+*     <build directory>/server -q <queue_size> -w <workers> -p <policy>
+*         [-d <dispatch>] [-h <event>] [-c <cpus>] [-n <cpus>] [-m]
+*         <port_number>
 *
 * Parameters:
 *     port_number - The port number to bind the server to.
 *     queue_size  - The maximum number of queued requests.
 *     workers     - The number of parallel threads to process requests.
 *     policy      - The queue policy to use for request dispatching.
+*     dispatch    - SHARED (one queue for all workers) or AFFINITY (one
+*                   queue per worker, requests routed by img_id).
+*     event       - Hardware event to profile: INSTR, L1MISS, LLCMISS or
+*                   CACHE (both L1 and LLC misses).
+*     -c cpus     - CPU list (e.g. 2-7,10) to pin workers to, one CPU per
+*                   worker in round-robin order.
+*     -n cpus     - CPU list for the network (accept/recv) thread. Defaults
+*                   to all the CPUs not used by workers when -c is given.
+*     -m          - Allocate registered images on the NUMA node of the
+*                   worker that will process them (requires -c).
 *
 * Author:
 *     Renato Mancuso
@@ -51,16 +63,29 @@
 /* Needed for semaphores */
 #include <semaphore.h>
 
+/* Needed for CPU and NUMA placement */
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
 /* Include struct definitions and other libraries that need to be
  * included by both client and server */
 #include "common.h"
 
+/* Lock-free queue shared by all the servers */
+#include "queuelib.h"
+#include "imgstore.h"
+
 #define BACKLOG_COUNT 100
 #define USAGE_STRING				\
 	"Missing parameter. Exiting.\n"		\
 	"Usage: %s -q <queue size> "		\
-	"-w <workers: 1> "			\
+	"-w <workers> "				\
 	"-p <policy: FIFO> "			\
+	"[-d <dispatch: SHARED | AFFINITY>] "	\
+	"[-h <event: INSTR | L1MISS | LLCMISS | CACHE>] " \
+	"[-c <worker cpus>] [-n <network cpus>] [-m] "	\
+	"[-P <image store dir>] "		\
 	"<port_number>\n"
 
 /* 4KB of stack for the worker thread */
@@ -77,20 +102,83 @@ sem_t * printf_mutex;
 		sem_post(printf_mutex);		\
 	} while (0)
 
-/* START - Variables needed to protect the shared queue. DO NOT TOUCH */
-sem_t * queue_mutex;
-sem_t * queue_notify;
-/* END - Variables needed to protect the shared queue. DO NOT TOUCH */
+/* In AFFINITY mode, an idle worker only steals from a peer whose
+ * queue holds at least this many requests */
+#define STEAL_THRESHOLD 2
+
+/* How long an idle worker blocks on its own queue before looking
+ * for work to steal again */
+#define STEAL_POLL_NS (500 * 1000)
 
 /* Global array of registered images and its length -- reallocated as we go! */
 struct image ** images = NULL;
 uint64_t image_count = 0;
 
+/* Worker whose queue receives requests on each image, in AFFINITY
+ * mode. Reallocated together with the images array. */
+int * image_home = NULL;
+
+/* MD5 of each image's pixels as uploaded, computed while the upload
+ * was received. All zeros for images produced or overwritten by an
+ * operation, or restored from the store. Reallocated together with
+ * the images array. */
+struct md5digest * image_digest = NULL;
+
+/* Protects images, image_home and image_count now that multiple
+ * workers may append to the array concurrently */
+pthread_mutex_t images_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Persistent copy of the registry, if enabled with -P. Every image
+ * that gets an ID is appended to it. */
+struct imgstore store;
+int persist = 0;
+
+/* Serializes writes on the client socket, so that a response and
+ * the image payload that follows it are never interleaved with the
+ * output of another worker */
+pthread_mutex_t socket_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Number of stripes in the table of per-image tickets */
+#define IMAGE_ORDER_STRIPES 64
+
+/* Requests on the same image must run in the order they arrived, even
+ * when several workers serve one queue or a request gets stolen. The
+ * network thread hands out a ticket per stripe of img_ids as it queues
+ * each request, and a worker only runs a request once its stripe is
+ * serving that ticket. */
+struct image_order {
+	pthread_mutex_t lock;
+	pthread_cond_t turn;
+	uint64_t next_ticket;   /* Only used by the network thread */
+	uint64_t serving;
+};
+
+struct image_order image_orders[IMAGE_ORDER_STRIPES];
+
+#define image_order(img_id)					\
+	(&image_orders[(img_id) % IMAGE_ORDER_STRIPES])
+
+/* Where to run the threads of the server and where to place the
+ * memory of registered images. Filled in while parsing the command
+ * line; left empty, everything runs wherever the scheduler decides. */
+struct placement_params {
+	int * worker_cpus;      /* CPU of each pinned worker slot */
+	size_t worker_cpu_count;
+	cpu_set_t net_cpus;     /* CPUs for the network thread */
+	int net_pinned;
+	int numa;               /* Place images on the worker's node */
+	int * worker_nodes;     /* NUMA node of each worker slot */
+};
+
+struct placement_params placement;
+
 struct request_meta {
 	struct request request;
 	struct timespec receipt_timestamp;
 	struct timespec start_timestamp;
 	struct timespec completion_timestamp;
+	uint64_t ticket;
+	uint8_t accept_enc;	/* From the connection's IMG_HELLO */
 };
 
 enum queue_policy {
@@ -98,26 +186,29 @@ enum queue_policy {
 	QUEUE_SJN
 };
 
+enum dispatch_policy {
+	DISPATCH_SHARED,
+	DISPATCH_AFFINITY
+};
+
 struct queue {
-	size_t wr_pos;
-	size_t rd_pos;
-	size_t max_size;
-	size_t available;
+	struct mpmc_queue ring;
 	enum queue_policy policy;
-	struct request_meta * requests;
 };
 
 enum task_issue {
     task_null,
     task_in,
     task_l1,
-    task_llc
+    task_llc,
+    task_cache
 };
 
 struct connection_params {
 	size_t queue_size;
 	size_t workers;
 	enum queue_policy queue_policy;
+	enum dispatch_policy dispatch;
 	enum task_issue task_issue;
 };
 
@@ -125,6 +216,8 @@ struct worker_params {
 	int conn_socket;
 	int worker_done;
 	struct queue * the_queue;
+	struct queue * queues;
+	size_t queue_count;
 	int worker_id;
 	enum task_issue task_issue;
 };
@@ -180,112 +273,407 @@ void remove_image_from_storage(uint64_t ige_try_id) {
 
 void queue_init(struct queue * the_queue, size_t queue_size, enum queue_policy policy)
 {
-	the_queue->rd_pos = 0;
-	the_queue->wr_pos = 0;
-	the_queue->max_size = queue_size;
-	the_queue->requests = (struct request_meta *)malloc(sizeof(struct request_meta)
-						     * the_queue->max_size);
-	the_queue->available = queue_size;
+	if (mpmc_init(&the_queue->ring, queue_size, sizeof(struct request_meta)) < 0) {
+		ERROR_INFO();
+		perror("Unable to allocate queue");
+		exit(EXIT_FAILURE);
+	}
 	the_queue->policy = policy;
 }
 
-/* Add a new request <request> to the shared queue <the_queue> */
+void queue_destroy(struct queue * the_queue)
+{
+	mpmc_destroy(&the_queue->ring);
+}
+
+/* Add a new request <request> to the shared queue <the_queue>.
+ * Returns 1 if the queue is full. */
 int add_to_queue(struct request_meta to_add, struct queue * the_queue)
 {
-	int rst = 0;
-	/* QUEUE PROTECTION INTRO START --- DO NOT TOUCH */
-	sem_wait(queue_mutex);
-	/* QUEUE PROTECTION INTRO END --- DO NOT TOUCH */
+	return (mpmc_try_push(&the_queue->ring, &to_add) == QUEUE_OK ? 0 : 1);
+}
 
-	/* WRITE YOUR CODE HERE! */
-	/* MAKE SURE NOT TO RETURN WITHOUT GOING THROUGH THE OUTRO CODE! */
+/* Get a request from the shared queue <the_queue>, waiting for one if
+ * it is empty. Returns 1 once the queue has been closed and drained. */
+int get_from_queue(struct queue * the_queue, struct request_meta * out)
+{
+	return (mpmc_pop(&the_queue->ring, out) == QUEUE_OK ? 0 : 1);
+}
 
-	/* Make sure that the queue is not full */
-	if (the_queue->available == 0) {
-		rst = 1;
-	} else {
-		/* If all good, add the item in the queue */
-		the_queue->requests[the_queue->wr_pos] = to_add;
-		the_queue->wr_pos = (the_queue->wr_pos + 1) % the_queue->max_size;
-		the_queue->available--;
-		/* QUEUE SIGNALING FOR CONSUMER --- DO NOT TOUCH */
-		sem_post(queue_notify);
-	}
-
-	/* QUEUE PROTECTION OUTRO START --- DO NOT TOUCH */
-	sem_post(queue_mutex);
-	/* QUEUE PROTECTION OUTRO END --- DO NOT TOUCH */
-	return rst;
+/* Number of requests currently waiting in <the_queue>. Only a
+ * snapshot, good enough for load-balancing decisions. */
+static size_t queue_depth(struct queue * the_queue)
+{
+	return mpmc_size(&the_queue->ring);
+}
+
+/* Wait until the stripe of the image of <req> serves its ticket.
+ * Returns 1 if the worker was asked to terminate meanwhile. */
+static int wait_turn(struct request_meta * req, struct worker_params * params)
+{
+	struct image_order * order = image_order(req->request.img_id);
+	int stopped;
+
+	pthread_mutex_lock(&order->lock);
+	while (order->serving != req->ticket && !params->worker_done) {
+		pthread_cond_wait(&order->turn, &order->lock);
+	}
+	stopped = (order->serving != req->ticket);
+	pthread_mutex_unlock(&order->lock);
+
+	return stopped;
 }
 
-/* Add a new request <request> to the shared queue <the_queue> */
-struct request_meta get_from_queue(struct queue * the_queue)
+/* Let the next request on the stripe of <req> run */
+static void end_turn(struct request_meta * req)
 {
-	struct request_meta rst;
-	/* QUEUE PROTECTION INTRO START --- DO NOT TOUCH */
-	sem_wait(queue_notify);
-	sem_wait(queue_mutex);
-	/* QUEUE PROTECTION INTRO END --- DO NOT TOUCH */
-
-	/* WRITE YOUR CODE HERE! */
-	/* MAKE SURE NOT TO RETURN WITHOUT GOING THROUGH THE OUTRO CODE! */
-	rst = the_queue->requests[the_queue->rd_pos];
-	the_queue->rd_pos = (the_queue->rd_pos + 1) % the_queue->max_size;
-	the_queue->available++;
-
-	/* QUEUE PROTECTION OUTRO START --- DO NOT TOUCH */
-	sem_post(queue_mutex);
-	/* QUEUE PROTECTION OUTRO END --- DO NOT TOUCH */
-	return rst;
+	struct image_order * order = image_order(req->request.img_id);
+
+	pthread_mutex_lock(&order->lock);
+	order->serving++;
+	pthread_cond_broadcast(&order->turn);
+	pthread_mutex_unlock(&order->lock);
+}
+
+/* Wake up every worker waiting for its turn, so that it notices the
+ * termination flag */
+static void wake_all_turns(void)
+{
+	int i;
+
+	for (i = 0; i < IMAGE_ORDER_STRIPES; ++i) {
+		pthread_mutex_lock(&image_orders[i].lock);
+		pthread_cond_broadcast(&image_orders[i].turn);
+		pthread_mutex_unlock(&image_orders[i].lock);
+	}
+}
+
+/* Only steal a request that can run right away. A thief that waited
+ * for an earlier request on the same image could be sitting on the
+ * head of its own queue, which that request may be queued behind. */
+static int turn_is_up(const void * elem, void * arg)
+{
+	const struct request_meta * req = (const struct request_meta *)elem;
+	struct image_order * order = image_order(req->request.img_id);
+	int ready;
+
+	(void)arg;
+	pthread_mutex_lock(&order->lock);
+	ready = (order->serving == req->ticket);
+	pthread_mutex_unlock(&order->lock);
+
+	return ready;
+}
+
+/* Map an image ID onto one of <workers> queues */
+static int hash_img_id(uint64_t img_id, size_t workers)
+{
+	/* Fibonacci hashing spreads consecutive IDs across workers */
+	return (int)(((img_id * 0x9E3779B97F4A7C15ULL) >> 32) % workers);
+}
+
+/* Pick the queue for a request in AFFINITY mode: the home worker of
+ * the image it operates on. */
+static struct queue * queue_for_request(struct request_meta * req,
+					struct queue * queues, size_t queue_count)
+{
+	int home = -1;
+
+	if (queue_count == 1) {
+		return &queues[0];
+	}
+
+	pthread_mutex_lock(&images_mutex);
+	if (req->request.img_id < image_count) {
+		home = image_home[req->request.img_id];
+	}
+	pthread_mutex_unlock(&images_mutex);
+
+	if (home < 0) {
+		home = hash_img_id(req->request.img_id, queue_count);
+	}
+
+	return &queues[home];
+}
+
+/* Fetch the next request for the worker described by <params>. A
+ * worker serves its own queue first; when that is empty it steals the
+ * head of the most loaded peer queue, but only if the imbalance is
+ * large enough to be worth losing cache locality and nothing else is
+ * in flight on that image (see turn_is_up). Returns 1 if the
+ * worker was asked to terminate, 0 otherwise. */
+static int dispatch_next(struct worker_params * params, struct request_meta * out,
+			 uint64_t * steals)
+{
+	struct queue * own = params->the_queue;
+
+	/* With a shared queue there is nothing to steal from */
+	if (params->queue_count == 1) {
+		return (get_from_queue(own, out) || params->worker_done);
+	}
+
+	while (!params->worker_done) {
+		struct timespec timeout = {0, STEAL_POLL_NS};
+		struct queue * victim = NULL;
+		size_t i, victim_depth = STEAL_THRESHOLD - 1;
+
+		if (mpmc_try_pop(&own->ring, out) == QUEUE_OK) {
+			return params->worker_done;
+		}
+
+		for (i = 0; i < params->queue_count; ++i) {
+			size_t depth = queue_depth(&params->queues[i]);
+			if (&params->queues[i] != own && depth > victim_depth) {
+				victim = &params->queues[i];
+				victim_depth = depth;
+			}
+		}
+
+		if (victim && mpmc_try_pop_if(&victim->ring, out, turn_is_up, NULL) == QUEUE_OK) {
+			(*steals)++;
+			return params->worker_done;
+		}
+
+		/* Nothing to do right now: block on our own queue for a
+		 * short while before looking at the peers again */
+		switch (mpmc_pop_timed(&own->ring, out, &timeout)) {
+		case QUEUE_OK:
+			return params->worker_done;
+		case QUEUE_CLOSED:
+			return 1;
+		default:
+			break;
+		}
+	}
+
+	return 1;
+}
+
+static void print_queued_request(const void * elem, void * arg)
+{
+	const struct request_meta * item = (const struct request_meta *)elem;
+	int * printed = (int *)arg;
+
+	printf("%sR%ld", (*printed)++ ? "," : "", item->request.req_id);
 }
 
 void dump_queue_status(struct queue * the_queue)
 {
-	size_t i, j;
-	/* QUEUE PROTECTION INTRO START --- DO NOT TOUCH */
-	sem_wait(queue_mutex);
-	/* QUEUE PROTECTION INTRO END --- DO NOT TOUCH */
+	int printed = 0;
 
-	/* WRITE YOUR CODE HERE! */
-	/* MAKE SURE NOT TO RETURN WITHOUT GOING THROUGH THE OUTRO CODE! */
 	sem_wait(printf_mutex);
 	printf("Q:[");
+	mpmc_for_each(&the_queue->ring, print_queued_request, &printed);
+	printf("]\n");
+	sem_post(printf_mutex);
+}
+
+/* Parse a CPU list such as "0-3,8,10-11" into <set>. Returns the
+ * number of CPUs in the list, or -1 if the list is malformed. */
+int parse_cpu_list(const char * list, cpu_set_t * set)
+{
+	const char * p = list;
+	char * end;
+	long first, last;
+
+	CPU_ZERO(set);
+	while (*p) {
+		first = strtol(p, &end, 10);
+		if (end == p || first < 0) {
+			return -1;
+		}
+		last = first;
+		p = end;
 
-	for (i = the_queue->rd_pos, j = 0; j < the_queue->max_size - the_queue->available;
-	     i = (i + 1) % the_queue->max_size, ++j)
-	{
-		printf("R%ld%s", the_queue->requests[i].request.req_id,
-		       ((j+1 != the_queue->max_size - the_queue->available)?",":""));
+		if (*p == '-') {
+			last = strtol(p + 1, &end, 10);
+			if (end == p + 1 || last < first) {
+				return -1;
+			}
+			p = end;
+		}
+
+		for (; first <= last && first < CPU_SETSIZE; ++first) {
+			CPU_SET(first, set);
+		}
+
+		if (*p == ',') {
+			++p;
+		} else if (*p) {
+			return -1;
+		}
 	}
 
-	printf("]\n");
-	sem_post(printf_mutex);
-	/* QUEUE PROTECTION OUTRO START --- DO NOT TOUCH */
-	sem_post(queue_mutex);
-	/* QUEUE PROTECTION OUTRO END --- DO NOT TOUCH */
+	return CPU_COUNT(set);
+}
+
+/* Return the NUMA node a CPU belongs to, as advertised in sysfs. On
+ * machines without NUMA information everything is on node 0. */
+int cpu_to_node(int cpu)
+{
+	char path[64];
+	struct dirent * entry;
+	DIR * dir;
+	int node = 0;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	dir = opendir(path);
+	if (!dir) {
+		return 0;
+	}
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (sscanf(entry->d_name, "node%d", &node) == 1) {
+			break;
+		}
+	}
+
+	closedir(dir);
+	return node;
+}
+
+/* Make the following allocations of the calling thread prefer NUMA
+ * node <node>, or go back to the default local policy if <node> is
+ * negative. Pages are placed when first touched, so this must be in
+ * effect while an image buffer is created and filled. */
+void prefer_numa_node(int node)
+{
+	unsigned long mask;
+
+	if (node < 0) {
+		syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+		return;
+	}
+
+	mask = 1UL << node;
+	if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8) < 0) {
+		ERROR_INFO();
+		perror("Unable to set NUMA memory policy");
+	}
 }
 
-void register_new_image(int conn_socket, struct request * req)
+/* Append <img> at the end of the global array of images and return
+ * its new ID. <home> is the worker whose queue will receive requests
+ * on this image in AFFINITY mode, or -1 to pick it by hashing the
+ * image ID. */
+uint64_t append_image(struct image * img, int home, struct md5digest digest)
 {
-	/* Increase the count of registered images */
-	image_count++;
+	uint64_t img_id;
+
+	pthread_mutex_lock(&images_mutex);
+	img_id = image_count++;
 
 	/* Reallocate array of image pointers */
 	images = realloc(images, image_count * sizeof(struct image *));
+	image_home = realloc(image_home, image_count * sizeof(int));
+	image_digest = realloc(image_digest, image_count * sizeof(struct md5digest));
+
+	images[img_id] = img;
+	image_home[img_id] = home;
+	image_digest[img_id] = digest;
+	pthread_mutex_unlock(&images_mutex);
+
+	return img_id;
+}
+
+/* Write the current content of <img_id> to the image store */
+static void persist_image(uint64_t img_id, struct image * img)
+{
+	if (persist && imgstore_append(&store, img_id, img) < 0) {
+		fprintf(stderr, "WARNING: image %lu not persisted\n", img_id);
+	}
+}
+
+/* Put an image found in the store back at its ID. Called before any
+ * connection is accepted, in write order. */
+static void load_stored_image(uint64_t img_id, struct image * img, void * arg)
+{
+	uint64_t i;
+
+	(void)arg;
+	if (img_id >= image_count) {
+		images = realloc(images, (img_id + 1) * sizeof(struct image *));
+		image_home = realloc(image_home, (img_id + 1) * sizeof(int));
+		image_digest = realloc(image_digest, (img_id + 1) * sizeof(struct md5digest));
+		for (i = image_count; i <= img_id; ++i) {
+			images[i] = NULL;
+			image_home[i] = -1;
+			memset(&image_digest[i], 0, sizeof(struct md5digest));
+		}
+		image_count = img_id + 1;
+	}
+
+	imgstore_release(&store, images[img_id]);
+	images[img_id] = img;
+}
+
+/* Pick the most compact encoding the client accepts for a RETRIEVE
+ * reply. Uploads need no negotiation: recvImage reads the encoding
+ * from the magic bytes. */
+static int reply_encoding(uint8_t accept_enc)
+{
+	if (IMG_ENC_ACCEPTS(accept_enc, IMG_ENC_LZ)) {
+		return IMG_ENC_LZ;
+	}
+	if (IMG_ENC_ACCEPTS(accept_enc, IMG_ENC_RGB)) {
+		return IMG_ENC_RGB;
+	}
+	return IMG_ENC_RAW;
+}
+
+/* Register a new image sent by the client. <workers> is the number of
+ * per-worker queues (1 unless in AFFINITY mode). Returns the ID
+ * assigned to the image. */
+uint64_t register_new_image(int conn_socket, struct request * req, size_t workers)
+{
+	uint64_t img_id;
+	int home = -1;
+	struct image * new_img;
+	struct md5digest digest;
+	char hex[33];
+	int i;
+
+	/* Pick the home worker up front so that the pixel buffer can
+	 * be allocated on its NUMA node while it is being received */
+	if (workers > 1) {
+		pthread_mutex_lock(&images_mutex);
+		home = hash_img_id(image_count, workers);
+		pthread_mutex_unlock(&images_mutex);
+	}
+
+	if (placement.numa && home >= 0) {
+		prefer_numa_node(placement.worker_nodes[home % placement.worker_cpu_count]);
+	}
 
-	/* Read in the new image from socket */
-	struct image * new_img = recvImage(conn_socket);
+	/* Read in the new image from socket, hashing the pixels as
+	 * they arrive */
+	memset(&digest, 0, sizeof(digest));
+	new_img = recvImageDigest(conn_socket, &digest);
+
+	if (placement.numa && home >= 0) {
+		prefer_numa_node(-1);
+	}
 
 	/* Store its pointer at the end of the global array */
-	images[image_count - 1] = new_img;
+	img_id = append_image(new_img, home, digest);
+	persist_image(img_id, new_img);
+
+	for (i = 0; i < 16; ++i) {
+		sprintf(hex + 2 * i, "%.2x", digest.__digest[i]);
+	}
+	sync_printf("INFO: image %lu registered, md5 %s\n", img_id, hex);
 
 	/* Immediately provide a response to the client */
 	struct response resp;
 	resp.req_id = req->req_id;
-	resp.img_id = image_count - 1;
+	resp.img_id = img_id;
 	resp.ack = RESP_COMPLETED;
 
+	pthread_mutex_lock(&socket_mutex);
 	send(conn_socket, &resp, sizeof(struct response), 0);
+	pthread_mutex_unlock(&socket_mutex);
+
+	return img_id;
 }
 
 /* Main logic of the worker thread */
@@ -300,7 +688,14 @@ void * worker_main (void * arg)
 
     /* Set up performance counter based on event type */
     int evt_fd = -1;
-    if (params->task_issue != task_null) {
+    int cache_fds[2] = {-1, -1};
+    uint64_t served = 0, steals = 0, l1_total = 0, llc_total = 0;
+
+    if (params->task_issue == task_cache) {
+        /* L1 and LLC misses are sampled together as one group */
+        setup_perf_cache_counters(cache_fds);
+        evt_fd = cache_fds[0];
+    } else if (params->task_issue != task_null) {
         uint64_t type, cfg;
         switch (params->task_issue) {
             case task_in:
@@ -334,21 +729,25 @@ void * worker_main (void * arg)
         struct image * img = NULL;
         uint64_t ige_try_id;
         
-        req = get_from_queue(params->the_queue);
+        if (dispatch_next(params, &req, &steals))
+            break;
 
-        if (params->worker_done)
+        /* Earlier requests on this image go first */
+        if (wait_turn(&req, params))
             break;
 
         clock_gettime(CLOCK_MONOTONIC, &req.start_timestamp);
 
         ige_try_id = req.request.img_id;
+        pthread_mutex_lock(&images_mutex);
         img = images[ige_try_id];
+        pthread_mutex_unlock(&images_mutex);
         assert(img != NULL);
 
         /* Reset and enable performance counter if applicable */
         if (evt_fd != -1) {
-            ioctl(evt_fd, PERF_EVENT_IOC_RESET, 0);
-            ioctl(evt_fd, PERF_EVENT_IOC_ENABLE, 0);
+            ioctl(evt_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(evt_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
         }
 
         /* Process image operation */
@@ -373,22 +772,37 @@ void * worker_main (void * arg)
         }
 
         /* Disable the counter and read the event count if applicable */
-        uint64_t ec = 0;
+        uint64_t ec = 0, l1_misses = 0, llc_misses = 0;
         if (evt_fd != -1) {
-            ioctl(evt_fd, PERF_EVENT_IOC_DISABLE, 0);
-            ec = read_perf_counter(evt_fd);
+            ioctl(evt_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            if (params->task_issue == task_cache) {
+                read_perf_cache_counters(cache_fds, &l1_misses, &llc_misses);
+                l1_total += l1_misses;
+                llc_total += llc_misses;
+            } else {
+                ec = read_perf_counter(evt_fd);
+            }
         }
+        served++;
 
-        /* Image overwriting and ID assignment */
+        /* Image overwriting and ID assignment. A new image stays
+         * with the worker that produced it, since its pixels are
+         * still hot in this worker's caches. */
         if (req.request.img_op != IMG_RETRIEVE) {
             if (req.request.overwrite) {
-                deleteImage(images[ige_try_id]);
+                pthread_mutex_lock(&images_mutex);
+                imgstore_release(persist ? &store : NULL, images[ige_try_id]);
                 images[ige_try_id] = img;
+                image_home[ige_try_id] = params->worker_id;
+                memset(&image_digest[ige_try_id], 0, sizeof(struct md5digest));
+                pthread_mutex_unlock(&images_mutex);
             } else {
-                ige_try_id = image_count++;
-                images = realloc(images, image_count * sizeof(struct image *));
-                images[ige_try_id] = img;
+                struct md5digest none;
+
+                memset(&none, 0, sizeof(none));
+                ige_try_id = append_image(img, params->worker_id, none);
             }
+            persist_image(ige_try_id, img);
         }
 
         clock_gettime(CLOCK_MONOTONIC, &req.completion_timestamp);
@@ -397,24 +811,39 @@ void * worker_main (void * arg)
         resp.req_id = req.request.req_id;
         resp.ack = RESP_COMPLETED;
         resp.img_id = ige_try_id;
+        pthread_mutex_lock(&socket_mutex);
         send(params->conn_socket, &resp, sizeof(struct response), 0);
 
         /* Send image payload if requested */
         if (req.request.img_op == IMG_RETRIEVE) {
-            uint8_t err = sendImage(img, params->conn_socket);
+            uint8_t err = sendImageEncoded(img, params->conn_socket,
+                                           reply_encoding(req.accept_enc));
             if (err) {
                 ERROR_INFO();
                 perror("Unable to send image payload to client.");
             }
         }
+        pthread_mutex_unlock(&socket_mutex);
+
+        end_turn(&req);
 
         /* Print the operation results and event counts */
         const char* ennmm = (params->task_issue == task_in) ? "INSTR" :
                                  (params->task_issue == task_l1) ? "L1MISS" :
                                  (params->task_issue == task_llc) ? "LLCMISS" : "";
         
-        if (req.request.img_op != IMG_REGISTER) {
-    		printf("T%d R%ld:%lf,%s,%d,%ld,%ld,%lf,%lf,%lf,%s,%lu\n",
+        if (params->task_issue == task_cache) {
+    		sync_printf("T%d R%ld:%lf,%s,%d,%ld,%ld,%lf,%lf,%lf,L1MISS,%lu,LLCMISS,%lu\n",
+           		params->worker_id, req.request.req_id,
+           		TSPEC_TO_DOUBLE(req.request.req_timestamp),
+           		OPCODE_TO_STRING(req.request.img_op),
+           		req.request.overwrite, req.request.img_id, ige_try_id,
+           		TSPEC_TO_DOUBLE(req.receipt_timestamp),
+           		TSPEC_TO_DOUBLE(req.start_timestamp),
+           		TSPEC_TO_DOUBLE(req.completion_timestamp),
+           		l1_misses, llc_misses);
+		} else if (req.request.img_op != IMG_REGISTER) {
+    		sync_printf("T%d R%ld:%lf,%s,%d,%ld,%ld,%lf,%lf,%lf,%s,%lu\n",
            		params->worker_id, req.request.req_id,
            		TSPEC_TO_DOUBLE(req.request.req_timestamp),
            		OPCODE_TO_STRING(req.request.img_op),
@@ -425,7 +854,7 @@ void * worker_main (void * arg)
            		ennmm, ec);
 		} else {
     		// For IMG_REGISTER, omit <event name> and <event count>
-    		printf("T%d R%ld:%lf,%s,%d,%ld,%ld,%lf,%lf,%lf\n",
+    		sync_printf("T%d R%ld:%lf,%s,%d,%ld,%ld,%lf,%lf,%lf\n",
            		params->worker_id, req.request.req_id,
            		TSPEC_TO_DOUBLE(req.request.req_timestamp),
            		OPCODE_TO_STRING(req.request.img_op),
@@ -438,7 +867,19 @@ void * worker_main (void * arg)
         dump_queue_status(params->the_queue);
     }
 
+    /* Per-worker summary, to compare locality across dispatch policies */
+    if (params->task_issue == task_cache) {
+        sync_printf("INFO: Worker %d served %lu requests (%lu stolen), L1MISS=%lu, LLCMISS=%lu\n",
+                    params->worker_id, served, steals, l1_total, llc_total);
+    } else {
+        sync_printf("INFO: Worker %d served %lu requests (%lu stolen)\n",
+                    params->worker_id, served, steals);
+    }
+
     /* Cleanup if evt_fd was used */
+    if (cache_fds[1] != -1) {
+        close(cache_fds[1]);
+    }
     if (evt_fd != -1) {
         close(evt_fd);
     }
@@ -493,7 +934,12 @@ int control_workers(enum worker_command cmd, size_t worker_count,
 
 
 			worker_params[i]->conn_socket = common_params->conn_socket;
-			worker_params[i]->the_queue = common_params->the_queue;
+			worker_params[i]->queues = common_params->queues;
+			worker_params[i]->queue_count = common_params->queue_count;
+			/* In AFFINITY mode each worker owns one queue */
+			worker_params[i]->the_queue = (common_params->queue_count > 1 ?
+						       &common_params->queues[i] :
+						       common_params->queues);
 			worker_params[i]->worker_done = 0;
 			worker_params[i]->worker_id = i;
 			worker_params[i]->task_issue = common_params->task_issue;
@@ -503,7 +949,20 @@ int control_workers(enum worker_command cmd, size_t worker_count,
 		/* All the allocations and initialization seem okay,
 		 * let's start the threads */
 		for (i = 0; i < worker_count; ++i) {
-			worker_ids[i] = pthread_create(&worker_pthreads[i], NULL, worker_main, worker_params[i]);
+			pthread_attr_t attr;
+			cpu_set_t cpus;
+
+			/* Pin the worker before it starts, so that its stack
+			 * and everything it allocates is local to its CPU */
+			pthread_attr_init(&attr);
+			if (placement.worker_cpu_count) {
+				CPU_ZERO(&cpus);
+				CPU_SET(placement.worker_cpus[i % placement.worker_cpu_count], &cpus);
+				pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+			}
+
+			worker_ids[i] = pthread_create(&worker_pthreads[i], &attr, worker_main, worker_params[i]);
+			pthread_attr_destroy(&attr);
 
 
 			if (worker_ids[i] < 0) {
@@ -513,6 +972,11 @@ int control_workers(enum worker_command cmd, size_t worker_count,
 			} else {
 				printf("INFO: Worker thread %ld (TID = %d) started!\n",
 				       i, worker_ids[i]);
+				if (placement.worker_cpu_count) {
+					printf("INFO: Worker thread %ld pinned to CPU %d (node %d)\n",
+					       i, placement.worker_cpus[i % placement.worker_cpu_count],
+					       placement.worker_nodes[i % placement.worker_cpu_count]);
+				}
 			}
 		}
 	}
@@ -540,6 +1004,10 @@ int control_workers(enum worker_command cmd, size_t worker_count,
 			worker_params[i]->worker_done = 1;
 		}
 
+		/* Workers waiting for their turn on an image will not get
+		 * it if the request ahead of them is never run */
+		wake_all_turns();
+
 
 		/* Next, unblock threads and wait for completion */
 		for (i = 0; i < worker_count; ++i) {
@@ -548,7 +1016,7 @@ int control_workers(enum worker_command cmd, size_t worker_count,
 			}
 
 
-			sem_post(queue_notify);
+			mpmc_close(&worker_params[i]->the_queue->ring);
 		}
 
 
@@ -593,8 +1061,10 @@ int control_workers(enum worker_command cmd, size_t worker_count,
 void handle_connection(int conn_socket, struct connection_params conn_params)
 {
 	struct request_meta * req;
-	struct queue * the_queue;
-	size_t in_bytes;
+	struct queue * queues, * the_queue;
+	struct image_order * order;
+	size_t in_bytes, queue_count, i;
+	uint8_t accept_enc = IMG_ENC_BIT(IMG_ENC_RAW);
 
 	/* The connection with the client is alive here. Let's start
 	 * the worker thread. */
@@ -602,12 +1072,24 @@ void handle_connection(int conn_socket, struct connection_params conn_params)
 	int res;
 	struct response resp;
 
-	/* Now handle queue allocation and initialization */
-	the_queue = (struct queue *)malloc(sizeof(struct queue));
-	queue_init(the_queue, conn_params.queue_size, conn_params.queue_policy);
+	/* Now handle queue allocation and initialization. In AFFINITY
+	 * mode every worker gets its own queue. */
+	queue_count = (conn_params.dispatch == DISPATCH_AFFINITY ? conn_params.workers : 1);
+	queues = (struct queue *)malloc(queue_count * sizeof(struct queue));
+	for (i = 0; i < queue_count; ++i) {
+		queue_init(&queues[i], conn_params.queue_size, conn_params.queue_policy);
+	}
+
+	/* Requests dropped by the previous connection left their
+	 * tickets unserved */
+	for (i = 0; i < IMAGE_ORDER_STRIPES; ++i) {
+		image_orders[i].next_ticket = 0;
+		image_orders[i].serving = 0;
+	}
 
 	common_worker_params.conn_socket = conn_socket;
-	common_worker_params.the_queue = the_queue;
+	common_worker_params.queues = queues;
+	common_worker_params.queue_count = queue_count;
 	common_worker_params.worker_done = 0;
     common_worker_params.worker_id = 0; // For single-threaded implementation
     common_worker_params.task_issue = conn_params.task_issue; // Set event_type here
@@ -618,7 +1100,7 @@ void handle_connection(int conn_socket, struct connection_params conn_params)
 	/* Do not continue if there has been a problem while starting
 	 * the workers. */
 	if (res != EXIT_SUCCESS) {
-		free(the_queue);
+		free(queues);
 
 		/* Stop any worker that was successfully started */
 		control_workers(WORKERS_STOP, conn_params.workers, NULL);
@@ -640,11 +1122,26 @@ void handle_connection(int conn_socket, struct connection_params conn_params)
 		 * and resp varaibles, and shutdown the socket. */
 		if (in_bytes > 0) {
 
+			/* Encoding negotiation, answered right away with
+			 * the subset of encodings we can produce */
+			if (req->request.img_op == IMG_HELLO) {
+				accept_enc = IMG_ENC_BIT(IMG_ENC_RAW) |
+					(req->request.img_id & (IMG_ENC_BIT(IMG_ENC_COUNT) - 1));
+
+				resp.req_id = req->request.req_id;
+				resp.img_id = accept_enc;
+				resp.ack = RESP_COMPLETED;
+				pthread_mutex_lock(&socket_mutex);
+				send(conn_socket, &resp, sizeof(struct response), 0);
+				pthread_mutex_unlock(&socket_mutex);
+				continue;
+			}
+
 			/* Handle image registration right away! */
 			if(req->request.img_op == IMG_REGISTER) {
 				clock_gettime(CLOCK_MONOTONIC, &req->start_timestamp);
 
-				register_new_image(conn_socket, &req->request);
+				uint64_t img_id = register_new_image(conn_socket, &req->request, queue_count);
 
 				clock_gettime(CLOCK_MONOTONIC, &req->completion_timestamp);
 
@@ -653,12 +1150,12 @@ void handle_connection(int conn_socket, struct connection_params conn_params)
 				       TSPEC_TO_DOUBLE(req->request.req_timestamp),
 				       OPCODE_TO_STRING(req->request.img_op),
 				       req->request.overwrite, req->request.img_id,
-				       image_count - 1, /* Registered ID on server side */
+				       img_id, /* Registered ID on server side */
 				       TSPEC_TO_DOUBLE(req->receipt_timestamp),
 				       TSPEC_TO_DOUBLE(req->start_timestamp),
 				       TSPEC_TO_DOUBLE(req->completion_timestamp));
 
-				dump_queue_status(the_queue);
+				dump_queue_status(&queues[0]);
 				continue;
 			
 
@@ -700,15 +1197,25 @@ void handle_connection(int conn_socket, struct connection_params conn_params)
 
 
 
+			/* Take a ticket in arrival order, and give it back
+			 * if the request is rejected */
+			order = image_order(req->request.img_id);
+			req->ticket = order->next_ticket++;
+			req->accept_enc = accept_enc;
+
+			the_queue = queue_for_request(req, queues, queue_count);
 			res = add_to_queue(*req, the_queue);
 
 			/* The queue is full if the return value is 1 */
 			if (res) {
+				order->next_ticket--;
 				struct response resp;
 				/* Now provide a response! */
 				resp.req_id = req->request.req_id;
 				resp.ack = RESP_REJECTED;
+				pthread_mutex_lock(&socket_mutex);
 				send(conn_socket, &resp, sizeof(struct response), 0);
+				pthread_mutex_unlock(&socket_mutex);
 
 				sync_printf("X%ld:%lf,%lf,%lf\n", req->request.req_id,
 				       TSPEC_TO_DOUBLE(req->request.req_timestamp),
@@ -723,6 +1230,11 @@ void handle_connection(int conn_socket, struct connection_params conn_params)
 	/* Stop all the worker threads. */
 	control_workers(WORKERS_STOP, conn_params.workers, NULL);
 
+	for (i = 0; i < queue_count; ++i) {
+		queue_destroy(&queues[i]);
+	}
+	free(queues);
+
 	free(req);
 	shutdown(conn_socket, SHUT_RDWR);
 	close(conn_socket);
@@ -730,6 +1242,55 @@ void handle_connection(int conn_socket, struct connection_params conn_params)
 }
 
 
+/* Complete the placement parameters once all the options are known
+ * and pin the calling (network) thread. Returns -1 on error. */
+int setup_placement(void)
+{
+	size_t i;
+	long cpu, online;
+
+	if (!placement.worker_cpu_count) {
+		if (placement.numa) {
+			fprintf(stderr, "WARNING: -m has no effect without -c\n");
+			placement.numa = 0;
+		}
+	} else {
+		placement.worker_nodes = (int *)malloc(placement.worker_cpu_count * sizeof(int));
+		if (!placement.worker_nodes) {
+			return -1;
+		}
+		for (i = 0; i < placement.worker_cpu_count; ++i) {
+			placement.worker_nodes[i] = cpu_to_node(placement.worker_cpus[i]);
+		}
+
+		/* By default keep the network thread off the worker cores */
+		if (!placement.net_pinned) {
+			online = sysconf(_SC_NPROCESSORS_ONLN);
+			CPU_ZERO(&placement.net_cpus);
+			for (cpu = 0; cpu < online && cpu < CPU_SETSIZE; ++cpu) {
+				CPU_SET(cpu, &placement.net_cpus);
+			}
+			for (i = 0; i < placement.worker_cpu_count; ++i) {
+				CPU_CLR(placement.worker_cpus[i], &placement.net_cpus);
+			}
+			placement.net_pinned = (CPU_COUNT(&placement.net_cpus) > 0);
+		}
+	}
+
+	if (placement.net_pinned) {
+		if (sched_setaffinity(0, sizeof(cpu_set_t), &placement.net_cpus) < 0) {
+			ERROR_INFO();
+			perror("Unable to pin network thread");
+			return -1;
+		}
+		printf("INFO: network thread pinned to %d CPU(s)\n",
+		       CPU_COUNT(&placement.net_cpus));
+	}
+
+	return 0;
+}
+
+
 /* Template implementation of the main function for the FIFO
  * server. The server must accept in input a command line parameter
  * with the <port number> to bind the server to. */
@@ -742,7 +1303,13 @@ int main (int argc, char ** argv) {
 	struct connection_params conn_params;
 	struct worker_params common_worker_params;
 	conn_params.queue_size = 0;
+	for (retval = 0; retval < IMAGE_ORDER_STRIPES; ++retval) {
+		pthread_mutex_init(&image_orders[retval].lock, NULL);
+		pthread_cond_init(&image_orders[retval].turn, NULL);
+	}
 	conn_params.queue_policy = QUEUE_FIFO;
+	conn_params.dispatch = DISPATCH_SHARED;
+	conn_params.task_issue = task_null;
 	conn_params.workers = 1;
 	// In your main function, after parsing command-line arguments
 	
@@ -754,7 +1321,7 @@ int main (int argc, char ** argv) {
 	*/
 
 	/* Parse all the command line arguments */
-	while((opt = getopt(argc, argv, "q:w:p:h:")) != -1) {
+	while((opt = getopt(argc, argv, "q:w:p:d:h:c:n:mP:")) != -1) {
 		switch (opt) {
 		case 'q':
 			conn_params.queue_size = strtol(optarg, NULL, 10);
@@ -763,9 +1330,9 @@ int main (int argc, char ** argv) {
 		case 'w':
 			conn_params.workers = strtol(optarg, NULL, 10);
 			printf("INFO: setting worker count = %ld\n", conn_params.workers);
-			if (conn_params.workers != 1) {
+			if (conn_params.workers < 1) {
 				ERROR_INFO();
-				fprintf(stderr, "Only 1 worker is supported in this implementation!\n" USAGE_STRING, argv[0]);
+				fprintf(stderr, "At least 1 worker is required!\n" USAGE_STRING, argv[0]);
 				return EXIT_FAILURE;
 			}
 			break;
@@ -779,9 +1346,18 @@ int main (int argc, char ** argv) {
 			}
 			printf("INFO: setting queue policy = %s\n", optarg);
 			break;
-		default: /* '?' */
-			fprintf(stderr, USAGE_STRING, argv[0]);
-
+		case 'd':
+			if (!strcmp(optarg, "SHARED")) {
+				conn_params.dispatch = DISPATCH_SHARED;
+			} else if (!strcmp(optarg, "AFFINITY")) {
+				conn_params.dispatch = DISPATCH_AFFINITY;
+			} else {
+				ERROR_INFO();
+				fprintf(stderr, "Invalid dispatch policy.\n" USAGE_STRING, argv[0]);
+				return EXIT_FAILURE;
+			}
+			printf("INFO: setting dispatch policy = %s\n", optarg);
+			break;
 		case 'h':
 
 			if (!strcmp(optarg, "INSTR")) {
@@ -790,13 +1366,68 @@ int main (int argc, char ** argv) {
                 conn_params.task_issue = task_l1;
             } else if (!strcmp(optarg, "LLCMISS")) {
                 conn_params.task_issue = task_llc;
+            } else if (!strcmp(optarg, "CACHE")) {
+                conn_params.task_issue = task_cache;
             } else {
                 fprintf(stderr, "Invalid event type specified with -h\n" USAGE_STRING, argv[0]);
                 return EXIT_FAILURE;
             }
             printf("INFO: setting hardware event = %s\n", optarg);
             break;
+		case 'c':
+		{
+			cpu_set_t cpus;
+			int cpu;
 
+			if (parse_cpu_list(optarg, &cpus) <= 0) {
+				ERROR_INFO();
+				fprintf(stderr, "Invalid worker CPU list.\n" USAGE_STRING, argv[0]);
+				return EXIT_FAILURE;
+			}
+			placement.worker_cpus = (int *)malloc(CPU_COUNT(&cpus) * sizeof(int));
+			placement.worker_cpu_count = 0;
+			for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+				if (CPU_ISSET(cpu, &cpus)) {
+					placement.worker_cpus[placement.worker_cpu_count++] = cpu;
+				}
+			}
+			printf("INFO: setting worker CPUs = %s\n", optarg);
+			break;
+		}
+		case 'n':
+			if (parse_cpu_list(optarg, &placement.net_cpus) <= 0) {
+				ERROR_INFO();
+				fprintf(stderr, "Invalid network CPU list.\n" USAGE_STRING, argv[0]);
+				return EXIT_FAILURE;
+			}
+			placement.net_pinned = 1;
+			printf("INFO: setting network CPUs = %s\n", optarg);
+			break;
+		case 'm':
+			placement.numa = 1;
+			printf("INFO: enabling NUMA-aware image placement\n");
+			break;
+		case 'P':
+		{
+			struct timespec t0, t1;
+			long loaded;
+
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			loaded = imgstore_open(&store, optarg, load_stored_image, NULL);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			if (loaded < 0) {
+				ERROR_INFO();
+				fprintf(stderr, "Unable to open image store %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			persist = 1;
+			printf("INFO: loaded %ld images from store %s in %.3f s\n", loaded, optarg,
+			       TSPEC_TO_DOUBLE(t1) - TSPEC_TO_DOUBLE(t0));
+			break;
+		}
+		default: /* '?' */
+			fprintf(stderr, USAGE_STRING, argv[0]);
+			return EXIT_FAILURE;
 		}
 	}
 
@@ -815,6 +1446,10 @@ int main (int argc, char ** argv) {
 		return EXIT_FAILURE;
 	}
 
+	if (setup_placement() < 0) {
+		return EXIT_FAILURE;
+	}
+
 	/* Now onward to create the right type of socket */
 	sockfd = socket(AF_INET, SOCK_STREAM, 0);
 
@@ -874,29 +1509,9 @@ int main (int argc, char ** argv) {
 		return EXIT_FAILURE;
 	}
 
-	/* Initialize queue protection variables. DO NOT TOUCH. */
-	queue_mutex = (sem_t *)malloc(sizeof(sem_t));
-	queue_notify = (sem_t *)malloc(sizeof(sem_t));
-	retval = sem_init(queue_mutex, 0, 1);
-	if (retval < 0) {
-		ERROR_INFO();
-		perror("Unable to initialize queue mutex");
-		return EXIT_FAILURE;
-	}
-	retval = sem_init(queue_notify, 0, 0);
-	if (retval < 0) {
-		ERROR_INFO();
-		perror("Unable to initialize queue notify");
-		return EXIT_FAILURE;
-	}
-	/* DONE - Initialize queue protection variables */
-
 	/* Ready to handle the new connection with the client. */
 	handle_connection(accepted, conn_params);
 
-	free(queue_mutex);
-	free(queue_notify);
-
 	close(sockfd);
 	return EXIT_SUCCESS;
 }
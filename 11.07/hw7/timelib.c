@@ -63,7 +63,7 @@ uint64_t get_elapsed_busywait(long sec, long nsec)
 	/* Busy wait until enough time has elapsed */
 	do {
 		clock_gettime(CLOCK_MONOTONIC, &now);
-	} while (time_end.tv_sec > now.tv_sec || time_end.tv_nsec > now.tv_nsec);
+	} while (timespec_cmp(&time_end, &now) > 0);
 
 	/* Get end timestamp */
 	get_clocks(end);
@@ -79,7 +79,7 @@ void timespec_add (struct timespec * a, struct timespec * b)
 	 * seconds */
 	time_t addl_seconds = b->tv_sec;
 	a->tv_nsec += b->tv_nsec;
-	if (a->tv_nsec > NANO_IN_SEC) {
+	if (a->tv_nsec >= NANO_IN_SEC) {
 		addl_seconds += a->tv_nsec / NANO_IN_SEC;
 		a->tv_nsec = a->tv_nsec % NANO_IN_SEC;
 	}
@@ -118,7 +118,7 @@ uint64_t busywait_timespec(struct timespec delay)
 	/* Busy wait until enough time has elapsed */
 	do {
 		clock_gettime(CLOCK_MONOTONIC, &now);
-	} while (delay.tv_sec > now.tv_sec || delay.tv_nsec > now.tv_nsec);
+	} while (timespec_cmp(&delay, &now) > 0);
 
 	/* Get end timestamp */
 	get_clocks(end);
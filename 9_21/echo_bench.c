@@ -0,0 +1,194 @@
+/* Loopback benchmark for server_mt.
+ *
+ * Opens <connections> sockets to the echo server, then keeps one
+ * message of <size> bytes in flight on every connection for
+ * <seconds> seconds: as soon as the full echo of a message is back,
+ * the next one is sent. Everything is driven from a single epoll
+ * loop, so the client needs no more threads than the reactor does.
+ * Reports the connection setup time, the round trips per second and
+ * the round-trip latency percentiles. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MAX_EVENTS 1024
+#define MAX_SAMPLES (1 << 22)
+
+#define USAGE_STRING \
+    "Usage: %s [-c <connections>] [-s <message size>] [-d <seconds>] [-p <port>]\n"
+
+struct client_conn {
+    int fd;
+    size_t sent;
+    size_t received;
+    double start;
+};
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Send as much of the current message as the socket accepts */
+int send_some(struct client_conn *c, const char *msg, size_t size) {
+    while (c->sent < size) {
+        ssize_t n = send(c->fd, msg + c->sent, size - c->sent, MSG_NOSIGNAL);
+        if (n < 0)
+            return (errno == EAGAIN) ? 0 : -1;
+        c->sent += n;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int connections = 10000, port = 8080, opt;
+    size_t size = 64;
+    double duration = 5.0;
+    struct rlimit rl;
+
+    while ((opt = getopt(argc, argv, "c:s:d:p:")) != -1) {
+        switch (opt) {
+        case 'c': connections = atoi(optarg); break;
+        case 's': size = strtoul(optarg, NULL, 10); break;
+        case 'd': duration = atof(optarg); break;
+        case 'p': port = atoi(optarg); break;
+        default:
+            fprintf(stderr, USAGE_STRING, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (connections < 1 || size < 1) {
+        fprintf(stderr, USAGE_STRING, argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        if (rl.rlim_cur < (rlim_t)connections + 16)
+            fprintf(stderr, "WARNING: only %lu descriptors available\n", (unsigned long)rl.rlim_cur);
+    }
+
+    char *msg = malloc(size), *sink = malloc(size);
+    for (size_t i = 0; i < size; i++)
+        msg[i] = 'a' + i % 26;
+
+    struct client_conn *conns = calloc(connections, sizeof(struct client_conn));
+    double *samples = malloc(MAX_SAMPLES * sizeof(double));
+    long nsamples = 0, round_trips = 0, failed = 0;
+    int epoll_fd = epoll_create1(0);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    /* Connection setup, one at a time */
+    double t0 = now();
+    int open = 0;
+    for (int i = 0; i < connections; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0), one = 1;
+        if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            perror("connect");
+            if (fd >= 0)
+                close(fd);
+            break;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &(int){16 * 1024}, sizeof(int));
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLET, .data.ptr = &conns[i] };
+        conns[i].fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        open++;
+    }
+    double t1 = now();
+    printf("Connected %d/%d in %.3f s\n", open, connections, t1 - t0);
+
+    /* Start a message on every connection */
+    for (int i = 0; i < open; i++) {
+        conns[i].start = now();
+        if (send_some(&conns[i], msg, size) < 0)
+            failed++;
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    double end = now() + duration, begin = now();
+    while (now() < end) {
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, 100);
+        for (int i = 0; i < n; i++) {
+            struct client_conn *c = events[i].data.ptr;
+
+            if (c->fd < 0)
+                continue;
+            if (send_some(c, msg, size) < 0)
+                goto broken;
+
+            for (;;) {
+                ssize_t r = recv(c->fd, sink, size - c->received, 0);
+                if (r == 0 || (r < 0 && errno != EAGAIN))
+                    goto broken;
+                if (r < 0)
+                    break;
+                c->received += r;
+
+                if (c->received == size) {
+                    double t = now();
+                    if (nsamples < MAX_SAMPLES)
+                        samples[nsamples++] = t - c->start;
+                    round_trips++;
+
+                    c->sent = c->received = 0;
+                    c->start = t;
+                    if (send_some(c, msg, size) < 0)
+                        goto broken;
+                }
+            }
+            continue;
+broken:
+            failed++;
+            close(c->fd);
+            c->fd = -1;
+        }
+    }
+    double elapsed = now() - begin;
+
+    qsort(samples, nsamples, sizeof(double), cmp_double);
+    printf("Round trips: %ld in %.3f s (%.0f/s), %ld connections failed\n",
+           round_trips, elapsed, round_trips / elapsed, failed);
+    if (nsamples) {
+        printf("Latency (us): p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+               samples[nsamples / 2] * 1e6, samples[(long)(nsamples * 0.9)] * 1e6,
+               samples[(long)(nsamples * 0.99)] * 1e6, samples[nsamples - 1] * 1e6);
+    }
+
+    for (int i = 0; i < open; i++)
+        if (conns[i].fd >= 0)
+            close(conns[i].fd);
+    free(conns);
+    free(samples);
+    free(msg);
+    free(sink);
+    return 0;
+}
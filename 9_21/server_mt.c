@@ -1,15 +1,65 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <time.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 
 #define PORT 8080
 
+/* Reactor defaults */
+#define DEFAULT_THREADS 4
+#define DEFAULT_BUFSIZE (64 * 1024)
+#define MAX_EVENTS 256
+
+#define USAGE_STRING \
+    "Usage: %s [-m single|thread|epoll] [-t <threads>] [-b <buffer size>] [-p <port>] [-v]\n" \
+    "  single - serve one connection, echoing and printing every buffer (default)\n" \
+    "  thread - one thread per accepted connection\n" \
+    "  epoll  - <threads> reactors with edge-triggered non-blocking sockets\n"
+
+enum server_mode { MODE_SINGLE, MODE_THREAD, MODE_EPOLL };
+
+struct server_config {
+    enum server_mode mode;
+    int threads;
+    size_t bufsize;
+    int port;
+    int verbose;
+};
+
+struct server_config config = { MODE_SINGLE, DEFAULT_THREADS, DEFAULT_BUFSIZE, PORT, 0 };
+
+/* Per-connection state of the reactor. Data that could not be written
+ * back yet is kept in pending; reading stops until it is flushed, so
+ * a slow reader cannot make the server buffer without bound. */
+struct conn {
+    int fd;
+    char *pending;
+    size_t pending_len;
+    size_t pending_off;
+    int want_out;  // Registered for EPOLLOUT while pending is not empty
+};
+
+struct reactor {
+    int id;
+    int listen_fd;
+    int epoll_fd;
+    char *buffer;
+    long connections;
+    pthread_t thread;
+};
+
 void *worker_main(void *arg) {
     struct timespec ts;
     while (1) {
@@ -23,47 +73,307 @@ void *worker_main(void *arg) {
 }
 
 void handle_connection(int socket) {
-    char buffer[1024];
-    int bytes_read;
-    while ((bytes_read = read(socket, buffer, sizeof(buffer) - 1)) > 0) {
-        buffer[bytes_read] = '\0';
-        printf("Received: %s\n", buffer);
+    char *buffer = malloc(config.bufsize);
+    ssize_t bytes_read;
+    while ((bytes_read = read(socket, buffer, config.bufsize - 1)) > 0) {
+        if (config.verbose) {
+            buffer[bytes_read] = '\0';
+            printf("Received: %s\n", buffer);
+        }
         write(socket, buffer, bytes_read);  // Echo back the received message
     }
+    free(buffer);
     close(socket);
 }
 
-int main() {
-    int server_fd, new_socket;
+void *connection_main(void *arg) {
+    handle_connection((int)(long)arg);
+    return NULL;
+}
+
+/* Listening socket with SO_REUSEPORT, so that every reactor can own
+ * one and the kernel spreads incoming connections among them */
+int create_listener(int port, int nonblocking) {
     struct sockaddr_in address;
     int opt = 1;
-    int addrlen = sizeof(address);
-    pthread_t thread_id;
+    int fd;
 
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
+    if ((fd = socket(AF_INET, SOCK_STREAM | (nonblocking ? SOCK_NONBLOCK : 0), 0)) < 0) {
         perror("socket failed");
         exit(EXIT_FAILURE);
     }
 
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt))) {
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt))) {
         perror("setsockopt");
         exit(EXIT_FAILURE);
     }
 
+    memset(&address, 0, sizeof(address));
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
+    address.sin_port = htons(port);
 
-    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
         perror("bind failed");
         exit(EXIT_FAILURE);
     }
 
-    if (listen(server_fd, 3) < 0) {
+    if (listen(fd, config.mode == MODE_SINGLE ? 3 : SOMAXCONN) < 0) {
         perror("listen");
         exit(EXIT_FAILURE);
     }
 
+    return fd;
+}
+
+void close_conn(struct reactor *r, struct conn *c) {
+    close(c->fd);  // Also removes it from the epoll set
+    free(c->pending);
+    free(c);
+    r->connections--;
+}
+
+/* Try to write out the pending data. Returns 1 if some is left. */
+int flush_pending(struct conn *c) {
+    while (c->pending_off < c->pending_len) {
+        ssize_t n = write(c->fd, c->pending + c->pending_off, c->pending_len - c->pending_off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return (errno == EAGAIN) ? 1 : -1;
+        }
+        c->pending_off += n;
+    }
+    c->pending_len = c->pending_off = 0;
+    return 0;
+}
+
+/* Echo everything available on the socket. With edge-triggered
+ * notifications we must drain it until EAGAIN, unless the peer is not
+ * reading its echoes, in which case we wait for EPOLLOUT. */
+int serve_conn(struct reactor *r, struct conn *c) {
+    int ret;
+
+    if (c->pending_len && (ret = flush_pending(c)) != 0)
+        return ret;
+
+    for (;;) {
+        ssize_t n = read(c->fd, r->buffer, config.bufsize);
+        if (n == 0)
+            return -1;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return (errno == EAGAIN) ? 0 : -1;
+        }
+
+        ssize_t w = write(c->fd, r->buffer, n);
+        if (w < 0) {
+            if (errno != EAGAIN)
+                return -1;
+            w = 0;
+        }
+
+        if (w < n) {
+            c->pending = realloc(c->pending, n - w);
+            memcpy(c->pending, r->buffer + w, n - w);
+            c->pending_len = n - w;
+            c->pending_off = 0;
+            return 1;
+        }
+    }
+}
+
+void accept_all(struct reactor *r) {
+    for (;;) {
+        int fd = accept4(r->listen_fd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN)
+                perror("accept");
+            return;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        struct conn *c = calloc(1, sizeof(struct conn));
+        struct epoll_event ev;
+        c->fd = fd;
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c;
+        if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl");
+            close(fd);
+            free(c);
+            continue;
+        }
+        r->connections++;
+    }
+}
+
+void *reactor_main(void *arg) {
+    struct reactor *r = (struct reactor *)arg;
+    struct epoll_event events[MAX_EVENTS];
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;  // NULL marks the listening socket
+    epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->listen_fd, &ev);
+
+    while (1) {
+        int n = epoll_wait(r->epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            struct conn *c = events[i].data.ptr;
+            if (c == NULL) {
+                accept_all(r);
+                continue;
+            }
+
+            int ret = serve_conn(r, c);
+            if (ret < 0 || (events[i].events & (EPOLLERR | EPOLLHUP))) {
+                close_conn(r, c);
+                continue;
+            }
+
+            /* Only ask for writable edges while an echo is stuck */
+            if (ret != c->want_out) {
+                c->want_out = ret;
+                ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (ret ? EPOLLOUT : 0);
+                ev.data.ptr = c;
+                epoll_ctl(r->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+void run_reactors(void) {
+    struct reactor *reactors = calloc(config.threads, sizeof(struct reactor));
+
+    for (int i = 0; i < config.threads; i++) {
+        reactors[i].id = i;
+        reactors[i].listen_fd = create_listener(config.port, 1);
+        reactors[i].epoll_fd = epoll_create1(0);
+        reactors[i].buffer = malloc(config.bufsize);
+        if (reactors[i].epoll_fd < 0 || !reactors[i].buffer) {
+            perror("reactor setup");
+            exit(EXIT_FAILURE);
+        }
+        pthread_create(&reactors[i].thread, NULL, reactor_main, &reactors[i]);
+    }
+
+    printf("INFO: %d epoll reactors on port %d, %zu byte buffers\n",
+           config.threads, config.port, config.bufsize);
+
+    for (int i = 0; i < config.threads; i++)
+        pthread_join(reactors[i].thread, NULL);
+}
+
+void run_threads(void) {
+    int server_fd = create_listener(config.port, 0);
+    pthread_t thread_id;
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, 64 * 1024 + config.bufsize);
+
+    while (1) {
+        int new_socket = accept(server_fd, NULL, NULL);
+        if (new_socket < 0) {
+            if (errno != EINTR)
+                perror("accept");
+            continue;
+        }
+        if (pthread_create(&thread_id, &attr, connection_main, (void *)(long)new_socket)) {
+            perror("pthread_create");
+            close(new_socket);
+        }
+    }
+}
+
+/* Thousands of connections need as many descriptors */
+void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+int main(int argc, char **argv) {
+    int server_fd, new_socket;
+    struct sockaddr_in address;
+    int addrlen = sizeof(address);
+    pthread_t thread_id;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:t:b:p:v")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (!strcmp(optarg, "single"))
+                config.mode = MODE_SINGLE;
+            else if (!strcmp(optarg, "thread"))
+                config.mode = MODE_THREAD;
+            else if (!strcmp(optarg, "epoll"))
+                config.mode = MODE_EPOLL;
+            else {
+                fprintf(stderr, USAGE_STRING, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 't':
+            config.threads = atoi(optarg);
+            break;
+        case 'b':
+            config.bufsize = strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            config.port = atoi(optarg);
+            break;
+        case 'v':
+            config.verbose = 1;
+            break;
+        default:
+            fprintf(stderr, USAGE_STRING, argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (config.threads < 1 || config.bufsize < 2) {
+        fprintf(stderr, USAGE_STRING, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    raise_fd_limit();
+
+    if (config.mode == MODE_EPOLL) {
+        run_reactors();
+        return 0;
+    }
+
+    if (config.mode == MODE_THREAD) {
+        run_threads();
+        return 0;
+    }
+
+    /* The original single-connection server, printing every buffer */
+    config.verbose = 1;
+    config.bufsize = 1024;
+    server_fd = create_listener(config.port, 0);
+
     if ((new_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t*)&addrlen)) < 0) {
         perror("accept");
         exit(EXIT_FAILURE);
@@ -73,8 +383,7 @@ int main() {
 
     handle_connection(new_socket);
 
-    
+
     pthread_join(thread_id, NULL);
     return 0;
 }
-
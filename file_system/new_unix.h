@@ -0,0 +1,35 @@
+// new_unix.c的库接口：编译时定义FS_NO_MAIN即可把new_unix.c当作库使用，调用方包含本文件
+#ifndef NEW_UNIX_H
+#define NEW_UNIX_H
+
+// 库接口fs_readdir返回的目录项
+typedef struct FS_DIRENT {
+    char name[8];
+    unsigned char is_dir;   // 1为目录
+    unsigned long size;     // 文件长度（字节数）
+} fs_dirent;
+
+// fs_open的flags
+#define FS_CREATE 1  // 不存在就新建
+#define FS_TRUNC  2  // 截断为空
+#define FS_APPEND 4  // 读写指针放到文件末尾
+
+// 按路径操作，不提示、不从stdin读，数据放在调用者的缓冲区里；失败返回-1
+// 路径以/开头时从根目录找，否则从当前目录找
+// 使用前调用startsys()挂载myfsys，用完调用my_exitsys()；之间可以多个线程同时调用fs_*，
+// 不同线程可以同时读写不同的文件，打开、关闭、建删文件和目录则一个一个来
+void startsys();
+void my_exitsys();
+int fs_open(const char *path, int flags);
+int fs_close(int fd);
+int fs_read(int fd, void *buf, int len);
+int fs_write(int fd, const void *buf, int len);
+int fs_mkdir(const char *path);
+int fs_unlink(const char *path);
+int fs_readdir(const char *path, fs_dirent *ents, int max);
+int fs_sync();
+int fs_chdir(const char *path);
+int fs_defrag(int budget);
+int fs_fsck();
+
+#endif
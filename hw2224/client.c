@@ -1,19 +1,41 @@
 // client.c
-
+//
+// 开环负载生成器：按预先生成的到达时间表发送请求，发送线程从不等待响应，
+// 每个连接由独立的接收线程收取响应。延迟从“计划发送时间”开始计算，
+// 即使发送线程落后于时间表也不会低估排队延迟（避免 coordinated omission）。
+//
+// 到达模式：
+//   POISSON - 泊松到达，平均速率 -a
+//   MMPP    - 两状态马尔可夫调制泊松过程（突发流量），平均速率仍为 -a
+//   TRACE   - 回放 send_timestamps.txt 中的到达间隔
+// 请求长度默认服从均值 1/-s 的指数分布，也可以用 -L 回放 request_lengths.txt。
+//
+// -c 把请求轮流分到多个连接上，只适用于能同时服务多个连接的服务器。
+// 本目录的 server_q 和 server_mt 只 accept 一个连接，其余连接上的请求
+// 永远得不到响应，会被计为 lost；对它们请使用默认的 -c 1。
+
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdint.h>
+#include <math.h>
 #include <time.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <errno.h>
 
+#include "loadlib.h"
+
 // 定义NANO_IN_SEC，用于时间转换
 #define NANO_IN_SEC (1000000000L)
 
+// 发送结束后等待剩余响应的最长时间（秒，无进展时）
+#define DRAIN_TIMEOUT 2.0
+
 // 请求结构体
 struct request {
     uint64_t req_id;
@@ -35,162 +57,546 @@ struct response {
         exit(EXIT_FAILURE);        \
     } while (0)
 
+#define USAGE_STRING \
+    "Usage: %s [-a <arrival rate>] [-s <service rate>] [-n <num requests>]\n" \
+    "          [-d <POISSON | MMPP | TRACE>] [-b <burst ratio>] [-t <mean burst dwell>]\n" \
+    "          [-T <timestamps file>] [-L <lengths file>] [-c <connections>]\n" \
+    "          [-r <seed>] [-o <records file>] [-f <csv | json>] [-R <summary csv>]\n" \
+    "          <server_port>\n"
+
+enum arrival_mode {
+    ARRIVAL_POISSON,
+    ARRIVAL_MMPP,
+    ARRIVAL_TRACE
+};
+
+// 每个请求的记录，按 req_id 索引
+struct record {
+    double intended;     // 计划发送时间（相对开始时刻）
+    double sent;         // 实际发送时间
+    double completed;    // 收到响应的时间，未完成为 0
+    double length;       // 请求长度（秒）
+    int conn;            // 使用的连接
+    int ack;             // 服务器返回的 ack，-1 表示没有响应
+};
+
+struct client_params {
+    double arrival_rate;
+    double service_rate;
+    long num_requests;
+    enum arrival_mode mode;
+    double burst_ratio;
+    double burst_dwell;
+    const char *timestamps_file;
+    const char *lengths_file;
+    int connections;
+    unsigned short seed[3];
+    const char *records_file;
+    int json;
+    const char *summary_file;
+};
+
+struct receiver_params {
+    int sockfd;
+    int conn;
+    long responses;      // 该连接收到的响应数
+};
+
+// 所有线程共享的状态
+struct record *records;
+long num_records;
+long num_sent;           // 实际发出的请求数，发送失败时小于 num_records
+struct timespec start_time;
+volatile long completed_count = 0;
+pthread_mutex_t completed_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct timespec double_to_tspec(double t)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t)t;
+    ts.tv_nsec = (long)((t - ts.tv_sec) * NANO_IN_SEC);
+    return ts;
+}
+
+// 均值为 1/rate 的指数分布随机数
+static double exp_sample(double rate, unsigned short seed[3])
+{
+    return -log(1.0 - erand48(seed)) / rate;
+}
+
+// 读取每行一个浮点数的文件，返回读取的个数
+static long load_column(const char *path, double **out)
+{
+    FILE *f = fopen(path, "r");
+    long count = 0, cap = 1024;
+    double value;
+
+    if (!f) {
+        ERROR_EXIT(path);
+    }
+
+    *out = (double *)malloc(cap * sizeof(double));
+    while (fscanf(f, "%lf", &value) == 1) {
+        if (count == cap) {
+            cap *= 2;
+            *out = (double *)realloc(*out, cap * sizeof(double));
+        }
+        (*out)[count++] = value;
+    }
+
+    fclose(f);
+    return count;
+}
+
+// 生成到达时间表和请求长度
+static void build_schedule(struct client_params *p)
+{
+    double *timestamps = NULL, *lengths = NULL;
+    long num_ts = 0, num_len = 0, i;
+    double t = 0.0;
+    // MMPP 状态：两种状态平均停留时间相同，速率比为 burst_ratio，
+    // 整体平均到达率保持为 arrival_rate
+    double rate_hi = p->arrival_rate * 2.0 * p->burst_ratio / (1.0 + p->burst_ratio);
+    double rate_lo = p->arrival_rate * 2.0 / (1.0 + p->burst_ratio);
+    double state_end = 0.0;
+    int bursting = 0;
+
+    if (p->mode == ARRIVAL_TRACE) {
+        num_ts = load_column(p->timestamps_file, &timestamps);
+        if (num_ts == 0) {
+            fprintf(stderr, "No timestamps in %s\n", p->timestamps_file);
+            exit(EXIT_FAILURE);
+        }
+        if (p->num_requests <= 0 || p->num_requests > num_ts) {
+            p->num_requests = num_ts;
+        }
+    }
+
+    if (p->lengths_file) {
+        num_len = load_column(p->lengths_file, &lengths);
+        if (num_len == 0) {
+            fprintf(stderr, "No lengths in %s\n", p->lengths_file);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    num_records = p->num_requests;
+    records = (struct record *)calloc(num_records, sizeof(struct record));
+    if (!records) {
+        ERROR_EXIT("calloc");
+    }
+
+    if (p->mode == ARRIVAL_MMPP) {
+        state_end = exp_sample(1.0 / p->burst_dwell, p->seed);
+    }
+
+    for (i = 0; i < num_records; ++i) {
+        switch (p->mode) {
+        case ARRIVAL_POISSON:
+            if (i > 0) {
+                t += exp_sample(p->arrival_rate, p->seed);
+            }
+            break;
+        case ARRIVAL_MMPP:
+            // 指数分布无记忆：跨越状态边界时从边界处重新抽样
+            for (;;) {
+                double next = t + exp_sample(bursting ? rate_hi : rate_lo, p->seed);
+                if (next < state_end) {
+                    t = next;
+                    break;
+                }
+                t = state_end;
+                bursting = !bursting;
+                state_end += exp_sample(1.0 / p->burst_dwell, p->seed);
+            }
+            break;
+        case ARRIVAL_TRACE:
+            t = timestamps[i] - timestamps[0];
+            break;
+        }
+
+        records[i].intended = t;
+        records[i].length = (lengths ? lengths[i % num_len]
+                                     : exp_sample(p->service_rate, p->seed));
+        records[i].conn = i % p->connections;
+        records[i].ack = -1;
+    }
+
+    // 从文件回放时，报告实际的到达率和服务率
+    if (p->mode == ARRIVAL_TRACE && num_records > 1 && t > 0) {
+        p->arrival_rate = (num_records - 1) / t;
+    }
+    if (lengths) {
+        double total = 0.0;
+        for (i = 0; i < num_records; ++i) {
+            total += records[i].length;
+        }
+        if (total > 0) {
+            p->service_rate = num_records / total;
+        }
+    }
+
+    free(timestamps);
+    free(lengths);
+}
+
+// 接收线程：只负责收响应并记录完成时间
+void *receiver_main(void *arg)
+{
+    struct receiver_params *rp = (struct receiver_params *)arg;
+    struct response res;
+    size_t got = 0;
+    ssize_t n;
+
+    for (;;) {
+        n = recv(rp->sockfd, (char *)&res + got, sizeof(res) - got, 0);
+        if (n <= 0) {
+            break;
+        }
+        got += n;
+        if (got < sizeof(res)) {
+            continue;
+        }
+        got = 0;
+
+        if (res.req_id >= (uint64_t)num_records) {
+            fprintf(stderr, "Response for unknown request %lu\n", res.req_id);
+            continue;
+        }
+
+        records[res.req_id].completed = load_elapsed(&start_time);
+        records[res.req_id].ack = res.ack;
+        rp->responses++;
+
+        pthread_mutex_lock(&completed_mutex);
+        completed_count++;
+        pthread_mutex_unlock(&completed_mutex);
+    }
+
+    return NULL;
+}
+
+static int connect_to_server(const char *ip, int port)
+{
+    struct sockaddr_in server_addr;
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (sockfd < 0) {
+        ERROR_EXIT("socket");
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &server_addr.sin_addr) <= 0) {
+        ERROR_EXIT("inet_pton");
+    }
+
+    if (connect(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        ERROR_EXIT("connect");
+    }
+
+    return sockfd;
+}
+
+static const char *mode_name(enum arrival_mode mode)
+{
+    return (mode == ARRIVAL_POISSON ? "POISSON" :
+            mode == ARRIVAL_MMPP ? "MMPP" : "TRACE");
+}
+
+static void write_records(struct client_params *p)
+{
+    FILE *f = fopen(p->records_file, "w");
+    long i;
+
+    if (!f) {
+        ERROR_EXIT(p->records_file);
+    }
+
+    if (p->json) {
+        fprintf(f, "[\n");
+    } else {
+        fprintf(f, "req_id,conn,intended,sent,completed,length,latency,ack\n");
+    }
+
+    for (i = 0; i < num_sent; ++i) {
+        struct record *r = &records[i];
+        double latency = (r->ack >= 0 ? r->completed - r->intended : -1.0);
+
+        if (p->json) {
+            fprintf(f, "  {\"req_id\": %ld, \"conn\": %d, \"intended\": %.9f, "
+                    "\"sent\": %.9f, \"completed\": %.9f, \"length\": %.9f, "
+                    "\"latency\": %.9f, \"ack\": %d}%s\n",
+                    i, r->conn, r->intended, r->sent, r->completed, r->length,
+                    latency, r->ack, (i + 1 < num_sent ? "," : ""));
+        } else {
+            fprintf(f, "%ld,%d,%.9f,%.9f,%.9f,%.9f,%.9f,%d\n",
+                    i, r->conn, r->intended, r->sent, r->completed, r->length,
+                    latency, r->ack);
+        }
+    }
+
+    if (p->json) {
+        fprintf(f, "]\n");
+    }
+    fclose(f);
+}
+
+// 统计并输出结果，只统计实际发出的请求。延迟 = 完成时间 - 计划发送时间
+static void report(struct client_params *p, double duration)
+{
+    double *lat = (double *)malloc((num_sent ? num_sent : 1) * sizeof(double));
+    double lag_max = 0.0;
+    long i, done = 0, rejected = 0, lost = 0;
+    struct load_summary lat_sum;
+    FILE *f;
+
+    if (!lat) {
+        ERROR_EXIT("malloc");
+    }
+
+    for (i = 0; i < num_sent; ++i) {
+        if (records[i].sent - records[i].intended > lag_max) {
+            lag_max = records[i].sent - records[i].intended;
+        }
+        if (records[i].ack < 0) {
+            lost++;
+        } else if (records[i].ack != 0) {
+            rejected++;
+        } else {
+            lat[done++] = records[i].completed - records[i].intended;
+        }
+    }
+
+    load_summarize(lat, done, &lat_sum);
+
+    printf("Mode: %s, Connections: %d\n", mode_name(p->mode), p->connections);
+    printf("Requests: %ld sent, %ld completed, %ld rejected, %ld without response\n",
+           num_sent, done, rejected, lost);
+    printf("Throughput: %.3f req/s over %.6f sec\n", (duration > 0 ? done / duration : 0.0), duration);
+    printf("Max send lag behind schedule: %.6f sec\n", lag_max);
+    printf("Latency (sec): mean %.6f, p50 %.6f, p90 %.6f, p99 %.6f, p99.9 %.6f, max %.6f\n",
+           lat_sum.mean, lat_sum.p50, lat_sum.p90, lat_sum.p99, lat_sum.p999, lat_sum.max);
+    printf("Average Response Time: %.6f sec\n", lat_sum.mean);
+
+    if (p->summary_file) {
+        f = fopen(p->summary_file, "a");
+        if (!f) {
+            ERROR_EXIT(p->summary_file);
+        }
+        // 新文件先写表头
+        if (ftell(f) == 0) {
+            fprintf(f, "mode,arrival_rate,service_rate,connections,sent,completed,"
+                    "rejected,lost,throughput,mean,p50,p90,p99,p999,max\n");
+        }
+        fprintf(f, "%s,%.6f,%.6f,%d,%ld,%ld,%ld,%ld,%.6f,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f\n",
+                mode_name(p->mode), p->arrival_rate, p->service_rate, p->connections,
+                num_sent, done, rejected, lost, (duration > 0 ? done / duration : 0.0),
+                lat_sum.mean, lat_sum.p50, lat_sum.p90, lat_sum.p99, lat_sum.p999, lat_sum.max);
+        fclose(f);
+    }
+
+    free(lat);
+}
+
 int main(int argc, char *argv[]) {
     int opt;
-    int arrival_time = 0;    // 参数 -a
-    int service_time = 0;    // 参数 -s
-    int num_requests = 0;    // 参数 -n
     char *server_ip = "127.0.0.1"; // 假设服务器在本地主机
     int server_port = 0;
+    struct client_params p;
+    int *sockfds;
+    pthread_t *receivers;
+    struct receiver_params *rparams;
+    long i, missing;
+    double duration;
+
+    memset(&p, 0, sizeof(p));
+    p.arrival_rate = 10.0;
+    p.service_rate = 20.0;
+    p.num_requests = 1000;
+    p.mode = ARRIVAL_POISSON;
+    p.burst_ratio = 10.0;
+    p.burst_dwell = 1.0;
+    p.timestamps_file = "send_timestamps.txt";
+    p.connections = 1;
+    p.seed[0] = 0x330e;
+    p.seed[1] = 0x1234;
+    p.seed[2] = 0xabcd;
 
     // 解析命令行参数
-    while ((opt = getopt(argc, argv, "a:s:n:")) != -1) {
+    while ((opt = getopt(argc, argv, "a:s:n:d:b:t:T:L:c:r:o:f:R:")) != -1) {
         switch (opt) {
             case 'a':
-                arrival_time = atoi(optarg);
+                p.arrival_rate = strtod(optarg, NULL);
                 break;
             case 's':
-                service_time = atoi(optarg);
+                p.service_rate = strtod(optarg, NULL);
                 break;
             case 'n':
-                num_requests = atoi(optarg);
+                p.num_requests = strtol(optarg, NULL, 10);
+                break;
+            case 'd':
+                if (!strcmp(optarg, "POISSON")) {
+                    p.mode = ARRIVAL_POISSON;
+                } else if (!strcmp(optarg, "MMPP")) {
+                    p.mode = ARRIVAL_MMPP;
+                } else if (!strcmp(optarg, "TRACE")) {
+                    p.mode = ARRIVAL_TRACE;
+                } else {
+                    fprintf(stderr, "Invalid arrival mode: %s\n" USAGE_STRING, optarg, argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'b':
+                p.burst_ratio = strtod(optarg, NULL);
+                break;
+            case 't':
+                p.burst_dwell = strtod(optarg, NULL);
+                break;
+            case 'T':
+                p.timestamps_file = optarg;
+                break;
+            case 'L':
+                p.lengths_file = optarg;
+                break;
+            case 'c':
+                p.connections = atoi(optarg);
+                break;
+            case 'r':
+                p.seed[0] = (unsigned short)strtoul(optarg, NULL, 10);
+                p.seed[1] = (unsigned short)(strtoul(optarg, NULL, 10) >> 16);
+                break;
+            case 'o':
+                p.records_file = optarg;
+                break;
+            case 'f':
+                if (!strcmp(optarg, "json")) {
+                    p.json = 1;
+                } else if (strcmp(optarg, "csv")) {
+                    fprintf(stderr, "Invalid output format: %s\n" USAGE_STRING, optarg, argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'R':
+                p.summary_file = optarg;
                 break;
             default:
-                fprintf(stderr, "Usage: %s -a arrival_time -s service_time -n num_requests <server_port>\n", argv[0]);
+                fprintf(stderr, USAGE_STRING, argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
 
     if (optind >= argc) {
         fprintf(stderr, "Expected server port after options\n");
-        fprintf(stderr, "Usage: %s -a arrival_time -s service_time -n num_requests <server_port>\n", argv[0]);
+        fprintf(stderr, USAGE_STRING, argv[0]);
         exit(EXIT_FAILURE);
     }
 
     server_port = atoi(argv[optind]);
 
-    if (arrival_time <= 0 || service_time <= 0 || num_requests <= 0 || server_port <= 0) {
-        fprintf(stderr, "Invalid arguments. All parameters must be positive integers.\n");
-        fprintf(stderr, "Usage: %s -a arrival_time -s service_time -n num_requests <server_port>\n", argv[0]);
+    if (p.arrival_rate <= 0 || p.service_rate <= 0 || p.connections <= 0 ||
+        p.burst_ratio < 1.0 || p.burst_dwell <= 0 || server_port <= 0 ||
+        (p.mode != ARRIVAL_TRACE && p.num_requests <= 0)) {
+        fprintf(stderr, "Invalid arguments. Rates, counts and times must be positive.\n");
+        fprintf(stderr, USAGE_STRING, argv[0]);
         exit(EXIT_FAILURE);
     }
 
+    build_schedule(&p);
+
     printf("Client Parameters:\n");
-    printf("Arrival Time: %d sec\n", arrival_time);
-    printf("Service Time: %d sec\n", service_time);
-    printf("Number of Requests: %d\n", num_requests);
+    printf("Arrival Mode: %s\n", mode_name(p.mode));
+    printf("Arrival Rate: %.3f req/s\n", p.arrival_rate);
+    printf("Service Rate: %.3f req/s%s\n", p.service_rate, (p.lengths_file ? " (lengths from file)" : ""));
+    printf("Number of Requests: %ld\n", num_records);
+    printf("Connections: %d\n", p.connections);
     printf("Server Port: %d\n", server_port);
 
-    // 创建TCP套接字
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-        ERROR_EXIT("socket");
-    }
-
-    // 设置服务器地址结构
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(server_port);
+    // 建立所有连接并启动接收线程
+    sockfds = (int *)malloc(p.connections * sizeof(int));
+    receivers = (pthread_t *)malloc(p.connections * sizeof(pthread_t));
+    rparams = (struct receiver_params *)malloc(p.connections * sizeof(struct receiver_params));
 
-    // 将服务器IP地址从文本转换为二进制形式
-    if (inet_pton(AF_INET, server_ip, &server_addr.sin_addr) <= 0) {
-        ERROR_EXIT("inet_pton");
-    }
-
-    // 连接到服务器
-    if (connect(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        ERROR_EXIT("connect");
+    for (i = 0; i < p.connections; ++i) {
+        sockfds[i] = connect_to_server(server_ip, server_port);
+        rparams[i].sockfd = sockfds[i];
+        rparams[i].conn = i;
+        rparams[i].responses = 0;
     }
 
     printf("Connected to server %s:%d\n", server_ip, server_port);
 
-    // 变量用于计算总响应时间
-    double total_response_time = 0.0;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
 
-    // 发送请求
-    for (int i = 0; i < num_requests; i++) {
-        struct request req;
-        req.req_id = i;
-
-        // 获取当前时间作为请求时间戳
-        if (clock_gettime(CLOCK_MONOTONIC, &req.req_timestamp) != 0) {
-            ERROR_EXIT("clock_gettime");
-        }
+    for (i = 0; i < p.connections; ++i) {
+        pthread_create(&receivers[i], NULL, receiver_main, &rparams[i]);
+    }
 
-        // 设置请求长度（处理时间）
-        req.req_length.tv_sec = service_time;
-        req.req_length.tv_nsec = 0;
+    // 按时间表发送：睡到绝对时间点，落后时立即发送，不等待响应
+    for (i = 0; i < num_records; ++i) {
+        struct record *r = &records[i];
+        struct request req;
 
-        // 记录发送时间
-        struct timespec send_time;
-        clock_gettime(CLOCK_MONOTONIC, &send_time);
+        load_sleep_until(&start_time, r->intended);
 
-        // 发送请求到服务器
-        ssize_t sent_bytes = send(sockfd, &req, sizeof(req), 0);
-        if (sent_bytes != sizeof(req)) {
-            fprintf(stderr, "Failed to send request %d: sent %zd bytes\n", i, sent_bytes);
-            close(sockfd);
-            exit(EXIT_FAILURE);
-        }
+        req.req_id = i;
+        req.req_length = double_to_tspec(r->length);
+        clock_gettime(CLOCK_MONOTONIC, &req.req_timestamp);
+        r->sent = load_elapsed(&start_time);
 
-        // 接收服务器的响应
-        struct response res;
-        ssize_t recv_bytes = recv(sockfd, &res, sizeof(res), 0);
-        if (recv_bytes < 0) {
-            ERROR_EXIT("recv");
-        } else if (recv_bytes == 0) {
-            fprintf(stderr, "Server closed connection unexpectedly.\n");
-            close(sockfd);
-            exit(EXIT_FAILURE);
-        } else if (recv_bytes != sizeof(res)) {
-            fprintf(stderr, "Incomplete response received for request %d: received %zd bytes\n", i, recv_bytes);
-            close(sockfd);
-            exit(EXIT_FAILURE);
+        if (send(sockfds[r->conn], &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req)) {
+            fprintf(stderr, "Failed to send request %ld\n", i);
+            break;
         }
+    }
+    num_sent = i;
 
-        // 记录接收时间
-        struct timespec recv_time;
-        clock_gettime(CLOCK_MONOTONIC, &recv_time);
-
-        // 计算响应时间
-        double response_time = (recv_time.tv_sec - send_time.tv_sec) +
-                               (recv_time.tv_nsec - send_time.tv_nsec) / 1e9;
-
-        total_response_time += response_time;
+    // 等待剩余响应；服务器丢弃请求时不会回复，因此没有进展一段时间后放弃
+    missing = load_drain(&completed_count, num_sent, DRAIN_TIMEOUT);
+    if (missing) {
+        fprintf(stderr, "Giving up on %ld requests without response\n", missing);
+    }
 
-        // 验证响应
-        if (res.req_id != req.req_id || res.ack != 0) {
-            fprintf(stderr, "Invalid response for request %d: req_id=%ld, ack=%d\n", i, res.req_id, res.ack);
+    // 吞吐量按最后一个响应到达的时刻计算，不包括等待超时的时间
+    duration = 0.0;
+    for (i = 0; i < num_sent; ++i) {
+        if (records[i].completed > duration) {
+            duration = records[i].completed;
         }
+    }
 
-        // 输出响应信息（可选）
-        /*
-        printf("Received response for request %d: req_id=%ld, ack=%d, response_time=%.6f sec\n",
-               i, res.req_id, res.ack, response_time);
-        */
-
-        // 模拟请求到达间隔时间
-        if (i < num_requests - 1) { // 最后一个请求后无需等待
-            struct timespec sleep_time;
-            sleep_time.tv_sec = arrival_time;
-            sleep_time.tv_nsec = 0;
+    // 关闭连接，唤醒阻塞在 recv 上的接收线程
+    for (i = 0; i < p.connections; ++i) {
+        shutdown(sockfds[i], SHUT_RDWR);
+    }
+    for (i = 0; i < p.connections; ++i) {
+        pthread_join(receivers[i], NULL);
+        close(sockfds[i]);
+    }
 
-            if (nanosleep(&sleep_time, NULL) != 0) {
-                perror("nanosleep");
-                // 如果被信号中断，可以选择继续或退出
-            }
+    // 某个连接完全没有响应，多半是服务器只服务一个连接
+    for (i = 0; i < p.connections; ++i) {
+        if (p.connections > 1 && rparams[i].responses == 0 && num_sent > i) {
+            fprintf(stderr, "Connection %ld got no responses; the server may accept "
+                    "only one connection (use -c 1)\n", i);
         }
     }
 
-    // 计算平均响应时间
-    double average_response_time = total_response_time / num_requests;
-    printf("Average Response Time: %.6f sec\n", average_response_time);
+    report(&p, duration);
+    if (p.records_file) {
+        write_records(&p);
+    }
 
-    printf("All %d requests sent and responses received.\n", num_requests);
+    if (num_sent == num_records) {
+        printf("All %ld requests sent.\n", num_records);
+    } else {
+        printf("Only %ld of %ld requests sent.\n", num_sent, num_records);
+    }
 
-    // 关闭套接字
-    close(sockfd);
+    free(records);
+    free(sockfds);
+    free(receivers);
+    free(rparams);
     return 0;
 }
-
@@ -45,7 +45,7 @@ struct response {
 };
 
 struct request_meta {
-	struct timespec receipt_ts;
+	uint64_t receipt_ns;	/* TSC stamp, see tsc_now_ns() */
 	struct request req;
 };
 
@@ -1,45 +1,66 @@
 #!/bin/bash
 
+# Sweep arrival modes and rates against server_q using the open-loop client.
+# Client-side latency percentiles come from the client's summary CSV (-R);
+# utilization and queue length are still reported by the server.
+#
+# Usage: ./run_experiments.sh [port]
+# Override the sweep with e.g. MODES="POISSON" RATES="5 10" SERVICE=15 N=500
+
+PORT=${1:-2222}
+MODES=${MODES:-"POISSON MMPP"}
+RATES=${RATES:-$(seq 1 15)}
+SERVICE=${SERVICE:-15}
+N=${N:-1000}
 
 RESULT_FILE="experiment_results.csv"
+CLIENT_SUMMARY="client_summary.csv"
 if [ -f "$RESULT_FILE" ]; then
     mv "$RESULT_FILE" "${RESULT_FILE}_backup_$(date +%Y%m%d%H%M%S).csv"
 fi
+rm -f "$CLIENT_SUMMARY"
 
-echo "a_parameter,Utilization,Average_Response_Time,Average_Queue_Length" > $RESULT_FILE
+run_one() {
+    # $1 = label, rest = client arguments
+    local label=$1
+    shift
 
-for a in {1..15}
-do
-    echo "Running experiment with a=$a..."
+    echo "Running experiment $label..."
 
-    ./server_q 2222 > server_log.txt 2>&1 &
+    ./build/server_q $PORT > server_log.txt 2>&1 &
     SERVER_PID=$!
-    echo "Server started with PID $SERVER_PID"
-
-    sleep 2
-
-    ./client -a $a -s 15 -n 1000 2222 > client_log.txt 2>&1
-
-    sleep 2
+    sleep 1
 
-    AVERAGE_RESPONSE_TIME=$(grep "Average Response Time" client_log.txt | awk '{print $4}')
+    ./build/client "$@" -R "$CLIENT_SUMMARY" $PORT > client_log.txt 2>&1
+    wait $SERVER_PID 2>/dev/null
 
     UTILIZATION=$(grep "Utilization:" server_log.txt | awk '{print $2}')
     AVERAGE_QUEUE_LENGTH=$(grep "Time-Weighted Average Queue Length:" server_log.txt | awk '{print $5}')
+    CLIENT_ROW=$(tail -n 1 "$CLIENT_SUMMARY")
 
-    if [[ -z "$UTILIZATION" || -z "$AVERAGE_RESPONSE_TIME" || -z "$AVERAGE_QUEUE_LENGTH" ]]; then
-        echo "Failed to extract metrics for a=$a. Check server_log.txt and client_log.txt"
-    else
-        echo "$a,$UTILIZATION,$AVERAGE_RESPONSE_TIME,$AVERAGE_QUEUE_LENGTH" >> $RESULT_FILE
-        echo "Experiment with a=$a completed: Utilization=$UTILIZATION, Average Response Time=$AVERAGE_RESPONSE_TIME, Average Queue Length=$AVERAGE_QUEUE_LENGTH"
+    if [[ -z "$UTILIZATION" || -z "$AVERAGE_QUEUE_LENGTH" || -z "$CLIENT_ROW" ]]; then
+        echo "Failed to extract metrics for $label. Check server_log.txt and client_log.txt"
+        return
     fi
 
-    kill $SERVER_PID
-    wait $SERVER_PID 2>/dev/null
+    if [ ! -f "$RESULT_FILE" ]; then
+        echo "$(head -n 1 "$CLIENT_SUMMARY"),utilization,avg_queue_length" > $RESULT_FILE
+    fi
+    echo "$CLIENT_ROW,$UTILIZATION,$AVERAGE_QUEUE_LENGTH" >> $RESULT_FILE
+    echo "Experiment $label completed: Utilization=$UTILIZATION, Average Queue Length=$AVERAGE_QUEUE_LENGTH"
+
     rm server_log.txt client_log.txt
+}
 
-    sleep 1
+for mode in $MODES
+do
+    for a in $RATES
+    do
+        run_one "mode=$mode a=$a" -d $mode -a $a -s $SERVICE -n $N
+    done
 done
 
-echo "All experiments completed. Results are in $RESULT_FILE"
+# Replay the recorded trace as-is
+run_one "mode=TRACE" -d TRACE -T send_timestamps.txt -L request_lengths.txt
 
+echo "All experiments completed. Results are in $RESULT_FILE"
@@ -10,10 +10,15 @@
  *     and calculates time-weighted average queue length and server utilization.
  *
  * Usage:
- *     ./server_q <port_number>
+ *     ./server_q [-s <sample_period_ms>] [-y <spin_us>] <port_number>
  *
  * Parameters:
- *     port_number - The port number to bind the server to.
+ *     port_number      - The port number to bind the server to.
+ *     sample_period_ms - If given, print a TW-line with the running queue
+ *                        length and utilization figures every period.
+ *     spin_us          - If given, simulate service by sleeping and only
+ *                        spinning for the last spin_us microseconds, so an
+ *                        idle simulated wait does not burn a whole core.
  *
  * Author:
  *     Renato Mancuso
@@ -52,55 +57,66 @@
 /* Include struct definitions and other libraries that need to be
  * included by both client and server */
 #include "common.h"
+#include "queuelib.h"
 #include <pthread.h>
 #include <time.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdatomic.h>
 
 /* Constants */
 #define BACKLOG_COUNT 100
 #define USAGE_STRING    \
  "Missing parameter. Exiting.\n"  \
- "Usage: %s <port_number>\n"
+ "Usage: %s [-s <sample_period_ms>] [-y <spin_us>] <port_number>\n"
 
 /* Queue size */
 #define QUEUE_SIZE 1000
 
-/* Snapshot related definitions */
-#define MAX_SNAPSHOTS 100000
-
-/* Structure to store queue snapshots */
-struct queue_snapshot {
-    struct timespec timestamp;
-    int queue_length;
+/* Time-weighted integral of a level (queue length, busy servers)
+ * that is updated without locks and can be read at any time.
+ *
+ * Every item that enters at time e and leaves at time d contributes
+ * d - e to the integral. Keeping base = sum(d) - sum(e) and the
+ * current level n, the integral up to time t is base + n * t, so an
+ * update is two fetch-adds and there is no "last event" timestamp to
+ * agree upon. Times are TSC nanosecond stamps taken relative to the
+ * start of the integrator to keep the products small. The begin/end
+ * counters let a reader detect that it raced with an update and retry
+ * until it gets a consistent copy. */
+struct tw_integrator {
+    uint64_t origin;
+    atomic_llong base;    // sum(leave) - sum(enter), in ns
+    atomic_long level;    // Items currently inside
+    atomic_ulong begin;   // Updates started
+    atomic_ulong end;     // Updates completed
 };
 
-/* Global variables for queue snapshots */
-struct queue_snapshot snapshots[MAX_SNAPSHOTS];
-int snapshot_count = 0;
-pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Queue length and number of busy workers of the connection */
+struct tw_integrator queue_len;
+struct tw_integrator busy;
+
+/* Reader attempts before yielding the CPU to the updaters */
+#define TW_READ_SPIN 16
 
 /* Structure for the queue */
 struct queue {
-    struct request_meta sigma[QUEUE_SIZE];
-    int alpha;  // Front index
-    int beta;   // Rear index
-    int gamma;  // Current queue size
+    struct mpmc_queue sigma;  // Lock-free ring of request_meta
 };
 
 /* Structure for worker thread parameters */
 struct worker_params {
     struct queue *delta; // Shared queue between worker thread and parent
     int epsilon;         // Socket descriptor
+    int done;            // Set when the client goes away
 };
 
-/* Global variables for queue protection */
-sem_t queue_mutex;
-sem_t queue_notify;
+/* Period of the sampled trace, 0 if disabled */
+long sample_period_ms = 0;
+atomic_int sampler_done;
 
-/* Variables for utilization calculation */
-double busy_time_total = 0.0;
-pthread_mutex_t busy_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Spin part of a hybrid service wait, in ns; -1 to spin throughout */
+long service_spin_ns = -1;
 
 /* Macro to print runtime errors with file and line number */
 #define ERROR_INFO()							\
@@ -109,172 +125,184 @@ pthread_mutex_t busy_mutex = PTHREAD_MUTEX_INITIALIZER;
 /* Macro to convert timespec to double seconds */
 #define TSPEC_TO_DOUBLE(spec) ((double)(spec.tv_sec) + (double)(spec.tv_nsec)/NANO_IN_SEC)
 
-/* Function to add a new request to the shared queue */
-int add_to_queue(struct request_meta zeta, struct queue * delta)
+static long long tw_ns(struct tw_integrator * tw, uint64_t ts)
 {
-    int retval = 0;
-
-    /* QUEUE PROTECTION INTRO START --- DO NOT TOUCH */
-    sem_wait(&queue_mutex);
-    /* QUEUE PROTECTION INTRO END --- DO NOT TOUCH */
+    return (long long)(ts - tw->origin);
+}
 
-    /* Write to the queue */
-    if(delta->gamma < QUEUE_SIZE) {
-        delta->sigma[delta->beta] = zeta;
-        delta->beta = (delta->beta + 1) % QUEUE_SIZE;
-        delta->gamma++;
-    } else {
-        retval = -1;
-    }
+void tw_init(struct tw_integrator * tw, uint64_t origin)
+{
+    tw->origin = origin;
+    atomic_init(&tw->base, 0);
+    atomic_init(&tw->level, 0);
+    atomic_init(&tw->begin, 0);
+    atomic_init(&tw->end, 0);
+}
 
-    /* Record queue state change */
-    struct timespec current_time;
-    clock_gettime(CLOCK_MONOTONIC, &current_time);
+/* Add <delta> items to the level at time <ts>; negative to remove */
+void tw_update(struct tw_integrator * tw, long delta, uint64_t ts)
+{
+    atomic_fetch_add_explicit(&tw->begin, 1, memory_order_acq_rel);
+    atomic_fetch_sub_explicit(&tw->base, delta * tw_ns(tw, ts), memory_order_relaxed);
+    atomic_fetch_add_explicit(&tw->level, delta, memory_order_relaxed);
+    atomic_fetch_add_explicit(&tw->end, 1, memory_order_release);
+}
 
-    pthread_mutex_lock(&snapshot_mutex);
-    if (snapshot_count < MAX_SNAPSHOTS) {
-        snapshots[snapshot_count].timestamp = current_time;
-        snapshots[snapshot_count].queue_length = delta->gamma;
-        snapshot_count++;
-    } else {
-        fprintf(stderr, "Snapshot buffer overflow!\n");
+/* Integral of the level from the origin up to <now>, in seconds */
+double tw_area(struct tw_integrator * tw, uint64_t now, long * level)
+{
+    long long base;
+    long cur;
+    unsigned long b, e;
+    int tries = 0;
+
+    /* A torn copy of base and level can be off by a whole
+     * timestamp, so never settle for one. Updates are a few
+     * instructions long: if they keep racing with us, let them run. */
+    for (;;) {
+        e = atomic_load_explicit(&tw->end, memory_order_acquire);
+        b = atomic_load_explicit(&tw->begin, memory_order_acquire);
+        base = atomic_load_explicit(&tw->base, memory_order_relaxed);
+        cur = atomic_load_explicit(&tw->level, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (b == e && atomic_load_explicit(&tw->begin, memory_order_relaxed) == b) {
+            break;
+        }
+        if (++tries % TW_READ_SPIN == 0) {
+            sched_yield();
+        }
     }
-    pthread_mutex_unlock(&snapshot_mutex);
 
-    /* QUEUE PROTECTION OUTRO START --- DO NOT TOUCH */
-    sem_post(&queue_mutex);
-    sem_post(&queue_notify);
-    /* QUEUE PROTECTION OUTRO END --- DO NOT TOUCH */
-    return retval;
+    if (level) {
+        *level = cur;
+    }
+    return (double)(base + cur * tw_ns(tw, now)) / NANO_IN_SEC;
 }
 
-/* Function to retrieve a request from the shared queue */
-struct request_meta get_from_queue(struct queue * delta)
+/* Function to add a new request to the shared queue. The request
+ * enters the integrator at its receipt time, before the push, so the
+ * worker can never account for its removal first. */
+int add_to_queue(struct request_meta zeta, struct queue * delta)
 {
-    struct request_meta retval;
+    tw_update(&queue_len, 1, zeta.receipt_ns);
+
+    /* Write to the queue */
+    if (mpmc_try_push(&delta->sigma, &zeta) != QUEUE_OK) {
+        /* Never queued: leaving at the same instant adds nothing */
+        tw_update(&queue_len, -1, zeta.receipt_ns);
+        return -1;
+    }
 
-    /* QUEUE PROTECTION INTRO START --- DO NOT TOUCH */
-    sem_wait(&queue_notify);
-    sem_wait(&queue_mutex);
-    /* QUEUE PROTECTION INTRO END --- DO NOT TOUCH */
+    return 0;
+}
 
+/* Function to retrieve a request from the shared queue. Returns -1
+ * once the queue has been closed and drained. The request leaves the
+ * queue and the worker becomes busy at time <now>. */
+int get_from_queue(struct queue * delta, struct request_meta * retval,
+                   uint64_t * now)
+{
     /* Read from the queue */
-    retval = delta->sigma[delta->alpha];
-    delta->alpha = (delta->alpha + 1) % QUEUE_SIZE;
-    delta->gamma--;
-
-    /* Record queue state change */
-    struct timespec current_time;
-    clock_gettime(CLOCK_MONOTONIC, &current_time);
-
-    pthread_mutex_lock(&snapshot_mutex);
-    if (snapshot_count < MAX_SNAPSHOTS) {
-        snapshots[snapshot_count].timestamp = current_time;
-        snapshots[snapshot_count].queue_length = delta->gamma;
-        snapshot_count++;
-    } else {
-        fprintf(stderr, "Snapshot buffer overflow!\n");
+    if (mpmc_pop(&delta->sigma, retval) != QUEUE_OK) {
+        return -1;
     }
-    pthread_mutex_unlock(&snapshot_mutex);
 
-    /* QUEUE PROTECTION OUTRO START --- DO NOT TOUCH */
-    sem_post(&queue_mutex);
-    /* QUEUE PROTECTION OUTRO END --- DO NOT TOUCH */
-    return retval;
+    *now = tsc_now_ns();
+    tw_update(&queue_len, -1, *now);
+    tw_update(&busy, 1, *now);
+
+    return 0;
 }
 
-/* Function to simulate busy-waiting (processing time) */
-void get_elapsed_busywait(long sec, long nsec)
+/* Sampler thread: print the running figures every sample period as
+ * TW:<time>,<queue length>,<avg queue length>,<utilization>. The tag
+ * keeps these lines apart from the Q:[...] queue dumps. */
+void* sampler_main(void *arg)
 {
-    struct timespec start, current;
-    clock_gettime(CLOCK_MONOTONIC, &start);
-    while (1) {
-        clock_gettime(CLOCK_MONOTONIC, &current);
-        long elapsed_sec = current.tv_sec - start.tv_sec;
-        long elapsed_nsec = current.tv_nsec - start.tv_nsec;
-        if (elapsed_nsec < 0) {
-            elapsed_sec--;
-            elapsed_nsec += 1000000000L;
-        }
-        if (elapsed_sec >= sec && elapsed_nsec >= nsec) {
-            break;
-        }
+    struct timespec next, period;
+    uint64_t now;
+    long level;
+
+    (void)arg;
+    period.tv_sec = sample_period_ms / 1000;
+    period.tv_nsec = (sample_period_ms % 1000) * 1000000;
+    next = ns_to_timespec(queue_len.origin);
+
+    while (!atomic_load(&sampler_done)) {
+        timespec_add(&next, &period);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        now = tsc_now_ns();
+        double elapsed = (double)tw_ns(&queue_len, now) / NANO_IN_SEC;
+        double q_area = tw_area(&queue_len, now, &level);
+        double busy_area = tw_area(&busy, now, NULL);
+
+        printf("TW:%.6f,%ld,%.3f,%.3f\n", TSPEC_TO_DOUBLE(ns_to_timespec(now)), level,
+               (elapsed > 0) ? q_area / elapsed : 0.0,
+               (elapsed > 0) ? busy_area / elapsed : 0.0);
     }
+
+    return NULL;
+}
+
+static void print_queued_request(const void *elem, void *arg)
+{
+    const struct request_meta *mu = (const struct request_meta *)elem;
+    int *printed = (int *)arg;
+
+    printf("%sR%ld", (*printed)++ ? "," : "", mu->req.req_id);
 }
 
 /* Function to dump the current queue status */
 void dump_queue_status(struct queue * delta)
 {
-    int i;
-    /* QUEUE PROTECTION INTRO START --- DO NOT TOUCH */
-    sem_wait(&queue_mutex);
-    /* QUEUE PROTECTION INTRO END --- DO NOT TOUCH */
+    int printed = 0;
 
     /* Write queue status to stdout */
     printf("Q:[");
-    for (i = 0; i < delta->gamma; i++) {
-        int index = (delta->alpha + i) % QUEUE_SIZE;
-        printf("R%ld", delta->sigma[index].req.req_id);
-        if (i < delta->gamma - 1) {
-            printf(",");
-        }
-    }
+    mpmc_for_each(&delta->sigma, print_queued_request, &printed);
     printf("]\n");
-
-    /* QUEUE PROTECTION OUTRO START --- DO NOT TOUCH */
-    sem_post(&queue_mutex);
-    /* QUEUE PROTECTION OUTRO END --- DO NOT TOUCH */
 }
 
 /* Worker thread main function */
 void* worker_main(void *arg)
 {
-    // 允许线程被取消
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-
     struct worker_params *params = (struct worker_params *)arg;
     struct queue *delta = params->delta;
     int sockfd = params->epsilon;
+    struct request_meta mu;
 
-    while (1) {
-        // Retrieve a request from the queue
-        struct request_meta mu = get_from_queue(delta);
+    uint64_t process_start;
 
+    // 客户端断开后退出，队列里剩下的请求直接丢弃
+    while (get_from_queue(delta, &mu, &process_start) == 0 && !params->done) {
         // Prepare the response
         struct response nu;
         nu.req_id = mu.req.req_id;    // Set request ID
         nu.ack = 0;                   // Acknowledge success
         nu.reserved = 0;
 
-        // Record the start processing time
-        struct timespec process_start;
-        clock_gettime(CLOCK_MONOTONIC, &process_start);
-
         // Simulate busy-waiting (processing time)
-        get_elapsed_busywait(mu.req.req_length.tv_sec, mu.req.req_length.tv_nsec);
-
-        // Record the end processing time
-        struct timespec process_end;
-        clock_gettime(CLOCK_MONOTONIC, &process_end);
-
-        // Calculate processing time and accumulate to busy_time_total
-        double processing_time = (process_end.tv_sec - process_start.tv_sec) +
-                                 (process_end.tv_nsec - process_start.tv_nsec) / 1e9;
+        if (service_spin_ns < 0) {
+            busywait_timespec(mu.req.req_length);
+        } else {
+            hybrid_wait_timespec(mu.req.req_length, service_spin_ns);
+        }
 
-        pthread_mutex_lock(&busy_mutex);
-        busy_time_total += processing_time;
-        pthread_mutex_unlock(&busy_mutex);
+        // Record the end processing time; the worker is idle again
+        uint64_t process_end = tsc_now_ns();
+        tw_update(&busy, -1, process_end);
 
         // Send the response back to the client
         send(sockfd, &nu, sizeof(struct response), 0);
 
-        // Extract and print timing information
+        // Extract and print timing information; TSC stamps are
+        // converted only here
         double eta = TSPEC_TO_DOUBLE(mu.req.req_timestamp);
         double iota = TSPEC_TO_DOUBLE(mu.req.req_length);
-        double nu_time = TSPEC_TO_DOUBLE(mu.receipt_ts);
-        double lambda_time = TSPEC_TO_DOUBLE(process_start);
-        double xi_time = TSPEC_TO_DOUBLE(process_end);
+        double nu_time = TSPEC_TO_DOUBLE(ns_to_timespec(mu.receipt_ns));
+        double lambda_time = TSPEC_TO_DOUBLE(ns_to_timespec(process_start));
+        double xi_time = TSPEC_TO_DOUBLE(ns_to_timespec(process_end));
 
         printf("R%ld:%.6f,%.6f,%.6f,%.6f,%.6f\n",
                mu.req.req_id, eta, iota, nu_time, lambda_time, xi_time);
@@ -296,24 +324,28 @@ void handle_connection(int epsilon)
     }
 
     /* Initialize the queue */
-    delta->alpha = 0;
-    delta->beta = 0;
-    delta->gamma = 0;
+    if (mpmc_init(&delta->sigma, QUEUE_SIZE, sizeof(struct request_meta)) < 0) {
+        perror("Failed to allocate queue");
+        free(delta);
+        close(epsilon);
+        return;
+    }
 
     /* Record the start time */
-    struct timespec start_time;
-    clock_gettime(CLOCK_MONOTONIC, &start_time);
-
-    /* Record the initial queue state */
-    pthread_mutex_lock(&snapshot_mutex);
-    if (snapshot_count < MAX_SNAPSHOTS) {
-        snapshots[snapshot_count].timestamp = start_time;
-        snapshots[snapshot_count].queue_length = delta->gamma;
-        snapshot_count++;
-    } else {
-        fprintf(stderr, "Snapshot buffer overflow!\n");
+    uint64_t start_time = tsc_now_ns();
+
+    /* Start integrating queue length and busy time */
+    tw_init(&queue_len, start_time);
+    tw_init(&busy, start_time);
+
+    /* Start the sampler thread, if requested */
+    pthread_t sampler_thread;
+    atomic_init(&sampler_done, 0);
+    if (sample_period_ms > 0 &&
+        pthread_create(&sampler_thread, NULL, sampler_main, NULL) != 0) {
+        perror("Failed to create sampler thread");
+        sample_period_ms = 0;
     }
-    pthread_mutex_unlock(&snapshot_mutex);
 
     /* Start the worker thread */
     pthread_t worker_thread;
@@ -321,9 +353,11 @@ void handle_connection(int epsilon)
 
     params.delta = delta;
     params.epsilon = epsilon;
+    params.done = 0;
 
     if (pthread_create(&worker_thread, NULL, worker_main, &params) != 0) {
         perror("Failed to create worker thread");
+        mpmc_destroy(&delta->sigma);
         free(delta);
         close(epsilon);
         return;
@@ -332,14 +366,15 @@ void handle_connection(int epsilon)
     /* Handle incoming requests */
     mu = (struct request *)malloc(sizeof(struct request));
     struct request_meta *nu = (struct request_meta*)malloc(sizeof(struct request_meta));
-    struct timespec omicron;
 
     if (mu == NULL || nu == NULL) {
         perror("Failed to allocate memory for requests");
         free(mu);
         free(nu);
-        pthread_cancel(worker_thread);
+        params.done = 1;
+        mpmc_close(&delta->sigma);
         pthread_join(worker_thread, NULL);
+        mpmc_destroy(&delta->sigma);
         free(delta);
         close(epsilon);
         return;
@@ -347,8 +382,7 @@ void handle_connection(int epsilon)
 
     int pi;
     while((pi = recv(epsilon, mu, sizeof(struct request), 0)) > 0){
-        clock_gettime(CLOCK_MONOTONIC, &omicron);
-        nu->receipt_ts = omicron;
+        nu->receipt_ns = tsc_now_ns();
         nu->req = *mu;
         add_to_queue(*nu, delta);
     }
@@ -356,58 +390,33 @@ void handle_connection(int epsilon)
     free(mu);
     free(nu);
 
-    /* Record the final queue state before closing */
-    struct timespec final_time;
-    clock_gettime(CLOCK_MONOTONIC, &final_time);
+    /* Calculate time-weighted average queue length and utilization
+     * up to the moment the client went away */
+    uint64_t final_time = tsc_now_ns();
 
-    pthread_mutex_lock(&snapshot_mutex);
-    if (snapshot_count < MAX_SNAPSHOTS) {
-        snapshots[snapshot_count].timestamp = final_time;
-        snapshots[snapshot_count].queue_length = delta->gamma;
-        snapshot_count++;
-    } else {
-        fprintf(stderr, "Snapshot buffer overflow!\n");
-    }
-    pthread_mutex_unlock(&snapshot_mutex);
-
-    /* Calculate time-weighted average queue length and utilization */
-    double cumulative_queue_time = 0.0;
-    double total_time = 0.0;
-
-    pthread_mutex_lock(&snapshot_mutex);
-    if (snapshot_count > 0) {
-        for (int i = 1; i < snapshot_count; i++) {
-            double elapsed = (snapshots[i].timestamp.tv_sec - snapshots[i-1].timestamp.tv_sec) +
-                             (snapshots[i].timestamp.tv_nsec - snapshots[i-1].timestamp.tv_nsec) / 1e9;
-            cumulative_queue_time += snapshots[i-1].queue_length * elapsed;
-            total_time += elapsed;
-        }
-
-        /* Handle the last snapshot up to the final_time */
-        if (snapshot_count > 0) {
-            double last_elapsed = (final_time.tv_sec - snapshots[snapshot_count-1].timestamp.tv_sec) +
-                                  (final_time.tv_nsec - snapshots[snapshot_count-1].timestamp.tv_nsec) / 1e9;
-            cumulative_queue_time += snapshots[snapshot_count-1].queue_length * last_elapsed;
-            total_time += last_elapsed;
-        }
+    double total_time = (double)tw_ns(&queue_len, final_time) / NANO_IN_SEC;
+    double cumulative_queue_time = tw_area(&queue_len, final_time, NULL);
+    double busy_time_total = tw_area(&busy, final_time, NULL);
 
-        double average_queue_length = (total_time > 0) ? (cumulative_queue_time / total_time) : 0.0;
+    double average_queue_length = (total_time > 0) ? (cumulative_queue_time / total_time) : 0.0;
 
-        /* Calculate utilization */
-        double utilization = (total_time > 0) ? (busy_time_total / total_time) : 0.0;
+    /* Calculate utilization */
+    double utilization = (total_time > 0) ? (busy_time_total / total_time) : 0.0;
 
-        printf("Time-Weighted Average Queue Length: %.3f\n", average_queue_length);
-        printf("Utilization: %.3f\n", utilization);
-    } else {
-        printf("No queue snapshots recorded.\n");
-    }
-    pthread_mutex_unlock(&snapshot_mutex);
+    printf("Time-Weighted Average Queue Length: %.3f\n", average_queue_length);
+    printf("Utilization: %.3f\n", utilization);
 
-    /* Terminate the worker thread */
-    pthread_cancel(worker_thread);
+    /* Terminate the worker and sampler threads */
+    params.done = 1;
+    mpmc_close(&delta->sigma);
     pthread_join(worker_thread, NULL);
+    if (sample_period_ms > 0) {
+        atomic_store(&sampler_done, 1);
+        pthread_join(sampler_thread, NULL);
+    }
 
     /* Clean up */
+    mpmc_destroy(&delta->sigma);
     free(delta);
     close(epsilon);
 }
@@ -421,9 +430,25 @@ int main(int argc, char ** argv)
     struct in_addr omega;
     socklen_t kappa;
 
+    /* Parse the optional sampling period and service wait mode */
+    int opt;
+    while ((opt = getopt(argc, argv, "s:y:")) != -1) {
+        switch (opt) {
+        case 's':
+            sample_period_ms = strtol(optarg, NULL, 10);
+            break;
+        case 'y':
+            service_spin_ns = strtol(optarg, NULL, 10) * 1000;
+            break;
+        default:
+            fprintf(stderr, USAGE_STRING, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
     /* Get port to bind our socket to */
-    if (argc > 1) {
-        phi = strtol(argv[1], NULL, 10);
+    if (argc > optind) {
+        phi = strtol(argv[optind], NULL, 10);
         printf("INFO: setting server port as: %d\n", phi);
     } else {
         ERROR_INFO();
@@ -431,6 +456,10 @@ int main(int argc, char ** argv)
         return EXIT_FAILURE;
     }
 
+    /* Calibrate the TSC clock used for all request timestamps */
+    tsc_clock_init();
+    printf("INFO: TSC runs at %.3f cycles/ns\n", tsc_cycles_per_ns());
+
     /* Now onward to create the right type of socket */
     rho = socket(AF_INET, SOCK_STREAM, 0);
 
@@ -470,11 +499,6 @@ int main(int argc, char ** argv)
         return EXIT_FAILURE;
     }
 
-    /* Initialize queue protection variables. DO NOT TOUCH. */
-    sem_init(&queue_mutex, 0, 1);
-    sem_init(&queue_notify, 0, 0);
-    /* DONE - Initialize queue protection variables. DO NOT TOUCH */
-
     /* Ready to accept connections! */
     printf("INFO: Waiting for incoming connection...\n");
     kappa = sizeof(struct sockaddr_in);
@@ -489,10 +513,6 @@ int main(int argc, char ** argv)
     /* Ready to handle the new connection with the client. */
     handle_connection(tau);
 
-    /* Clean up semaphores */
-    sem_destroy(&queue_mutex);
-    sem_destroy(&queue_notify);
-
     close(rho);
     return EXIT_SUCCESS;
 }
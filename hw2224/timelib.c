@@ -24,6 +24,8 @@
 *******************************************************************************/
 
 #include "timelib.h"
+#include <errno.h>
+#include <pthread.h>
 
 /* Return the number of clock cycles elapsed when waiting for
  * wait_time seconds using sleeping functions */
@@ -59,28 +61,87 @@ uint64_t get_elapsed_busywait(long sec, long nsec)
     /* IMPLEMENT ME! */
     /* IMPLEMENT ME! */
 
-    uint64_t beta, gamma;
-    struct timespec sigma;
     struct timespec delta;
 
-    /* Measure the current system time */
-    clock_gettime(CLOCK_MONOTONIC, &sigma);
     delta.tv_sec = sec;
     delta.tv_nsec = nsec;
-    timespec_add(&delta, &sigma);
 
-    /* Get the start timestamp */
-    get_clocks(beta);
+    return busywait_timespec(delta);
+}
 
-    /* Busy wait until enough time has elapsed */
-    do {
-        clock_gettime(CLOCK_MONOTONIC, &sigma);
-    } while (delta.tv_sec > sigma.tv_sec || delta.tv_nsec > sigma.tv_nsec);
+/* Anchor used by tsc_now_ns(). Before tsc_clock_init() it yields 0. */
+struct tsc_clock tsc_clk;
 
-    /* Get end timestamp */
-    get_clocks(gamma);
+/* Read CLOCK_MONOTONIC together with the TSC value at the same
+ * instant: of a few tries, keep the one whose bracketing TSC reads
+ * are closest, and use their midpoint */
+static void read_clock_pair(uint64_t * tsc, uint64_t * ns)
+{
+    struct timespec t;
+    uint64_t before, after, best = UINT64_MAX;
+    int i;
+
+    for (i = 0; i < 8; ++i) {
+        get_clocks(before);
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        get_clocks(after);
+
+        if (after - before < best) {
+            best = after - before;
+            *tsc = before + (after - before) / 2;
+            *ns = timespec_to_ns(t);
+        }
+    }
+}
+
+/* Cycles per nanosecond of the TSC, derived from tsc_clk.mult */
+static double tsc_rate;
+static pthread_once_t tsc_once = PTHREAD_ONCE_INIT;
+
+/* Calibrate over 50 ms, which keeps the rate error to well below a
+ * microsecond per second of run time. Both the fixed-point mult used
+ * by tsc_now_ns() and the rate used by the waits come from this one
+ * measurement, so the two always agree. */
+static void tsc_calibrate(void)
+{
+    struct timespec nap = {0, 50 * 1000 * 1000};
+    uint64_t c0, n0, c1, n1;
+
+    read_clock_pair(&c0, &n0);
+    nanosleep(&nap, NULL);
+    read_clock_pair(&c1, &n1);
+
+    tsc_clk.mult = (uint64_t)((((unsigned __int128)(n1 - n0)) << TSC_SHIFT) / (c1 - c0));
+    tsc_clk.tsc0 = c1;
+    tsc_clk.ns0 = n1;
+    tsc_rate = (double)(1ULL << TSC_SHIFT) / (double)tsc_clk.mult;
+}
 
-    return (gamma - beta);
+void tsc_clock_init(void)
+{
+    pthread_once(&tsc_once, tsc_calibrate);
+}
+
+double tsc_cycles_per_ns(void)
+{
+    tsc_clock_init();
+    return tsc_rate;
+}
+
+/* Spin on the TSC until it reaches the given value. The difference
+ * is compared as a signed quantity so that the check is correct
+ * whatever the absolute value of the counter. */
+void tsc_spin_until(uint64_t deadline)
+{
+    uint64_t now;
+
+    for (;;) {
+        get_clocks(now);
+        if ((int64_t)(now - deadline) >= 0) {
+            break;
+        }
+        cpu_pause();
+    }
 }
 
 /* Utility function to add two timespec structures together. The input
@@ -91,7 +152,7 @@ void timespec_add (struct timespec * a, struct timespec * b)
      * seconds */
     time_t epsilon = b->tv_sec;
     a->tv_nsec += b->tv_nsec;
-    if (a->tv_nsec > NANO_IN_SEC) {
+    if (a->tv_nsec >= NANO_IN_SEC) {
         epsilon += a->tv_nsec / NANO_IN_SEC;
         a->tv_nsec = a->tv_nsec % NANO_IN_SEC;
     }
@@ -118,20 +179,13 @@ int timespec_cmp(struct timespec *a, struct timespec *b)
 uint64_t busywait_timespec(struct timespec delay)
 {
     uint64_t start, end;
-    struct timespec current_time, end_time;
-
-    // 获取开始时间
-    clock_gettime(CLOCK_MONOTONIC, &current_time);
-    end_time = current_time;
-    timespec_add(&end_time, &delay);
+    double rate = tsc_cycles_per_ns();
 
     // 获取开始时的时钟周期
     get_clocks(start);
 
-    // 忙等待直到指定的延迟时间过去
-    do {
-        clock_gettime(CLOCK_MONOTONIC, &current_time);
-    } while (timespec_cmp(&current_time, &end_time) < 0);
+    // 只读TSC忙等待，不再在循环中调用clock_gettime
+    tsc_spin_until(start + (uint64_t)(timespec_to_ns(delay) * rate));
 
     // 获取结束时的时钟周期
     get_clocks(end);
@@ -139,3 +193,34 @@ uint64_t busywait_timespec(struct timespec delay)
     return end - start;
 }
 
+/* Sleep for most of a long delay and spin only for the tail, so that
+ * the wait does not keep a core busy but still ends on time */
+uint64_t hybrid_wait_timespec(struct timespec delay, long spin_ns)
+{
+    uint64_t start, end, deadline;
+    struct timespec wake;
+    double rate = tsc_cycles_per_ns();
+
+    get_clocks(start);
+    deadline = start + (uint64_t)(timespec_to_ns(delay) * rate);
+
+    // 时间足够长时，先睡到截止时间前spin_ns处，剩下的部分再忙等；
+    // 短于DEFAULT_SPIN_THRESHOLD_NS的等待睡眠唤醒太慢，全部忙等
+    if (spin_ns >= 0 && timespec_to_ns(delay) >= DEFAULT_SPIN_THRESHOLD_NS
+        && timespec_to_ns(delay) > (uint64_t)spin_ns) {
+        uint64_t sleep_ns = timespec_to_ns(delay) - spin_ns;
+        struct timespec nap;
+
+        clock_gettime(CLOCK_MONOTONIC, &wake);
+        nap.tv_sec = sleep_ns / NANO_IN_SEC;
+        nap.tv_nsec = sleep_ns % NANO_IN_SEC;
+        timespec_add(&wake, &nap);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR);
+    }
+
+    tsc_spin_until(deadline);
+    get_clocks(end);
+
+    return end - start;
+}
+
@@ -41,9 +41,17 @@
         asm volatile("rdtsc" : "=a" (__a), "=d" (__d)); \
         (clocks) = ((uint64_t)__d << 32) | __a; \
     } while(0)
+
+/* Hint to the core that we are in a spin loop */
+#define cpu_pause() asm volatile("pause" ::: "memory")
 #else
 #error "get_clocks is only implemented for x86_64 architecture."
 #endif
+
+/* Waits shorter than this are never turned into a sleep by
+ * hybrid_wait_timespec: the wakeup latency of clock_nanosleep is
+ * in the tens of microseconds */
+#define DEFAULT_SPIN_THRESHOLD_NS (100 * 1000)
    
 /* IMPLEMENT ME! See lecture slides for inspiration. */
 
@@ -59,6 +67,61 @@ uint64_t get_elapsed_busywait(long sec, long nsec);
  * parameter */
 uint64_t busywait_timespec(struct timespec delay);
 
+/* Sleep for all but the last spin_ns nanoseconds of delay, then
+ * busywait the rest. Delays below DEFAULT_SPIN_THRESHOLD_NS, or
+ * a negative spin_ns, are busywaited entirely. Returns the clock
+ * cycles elapsed. */
+uint64_t hybrid_wait_timespec(struct timespec delay, long spin_ns);
+
+/* TSC frequency in cycles per nanosecond, from the same calibration
+ * as tsc_clk; calibrates on first use */
+double tsc_cycles_per_ns(void);
+
+/* Spin on the TSC until it reaches the given value */
+void tsc_spin_until(uint64_t deadline);
+
+/* Conversion from TSC readings to CLOCK_MONOTONIC nanoseconds:
+ * ns = ns0 + ((tsc - tsc0) * mult) >> TSC_SHIFT */
+#define TSC_SHIFT 32
+
+struct tsc_clock {
+    uint64_t tsc0;
+    uint64_t ns0;
+    uint64_t mult;
+};
+
+extern struct tsc_clock tsc_clk;
+
+/* Calibrate the TSC against CLOCK_MONOTONIC and anchor the two
+ * clocks. Only the first call (from any thread) measures; later ones
+ * return at once. Call at startup, before the first tsc_now_ns(). */
+void tsc_clock_init(void);
+
+/* Current CLOCK_MONOTONIC time in nanoseconds, read from the TSC
+ * with no system call and no floating point */
+static inline uint64_t tsc_now_ns(void)
+{
+    uint64_t now;
+    get_clocks(now);
+    return tsc_clk.ns0 +
+        (uint64_t)(((unsigned __int128)(now - tsc_clk.tsc0) * tsc_clk.mult) >> TSC_SHIFT);
+}
+
+/* Convert a nanosecond stamp to a timespec, for logging */
+static inline struct timespec ns_to_timespec(uint64_t ns)
+{
+    struct timespec ts;
+    ts.tv_sec = ns / NANO_IN_SEC;
+    ts.tv_nsec = ns % NANO_IN_SEC;
+    return ts;
+}
+
+/* Convert a timespec to a nanosecond stamp */
+static inline uint64_t timespec_to_ns(struct timespec ts)
+{
+    return (uint64_t)ts.tv_sec * NANO_IN_SEC + ts.tv_nsec;
+}
+
 /* Add two timespec structures together */
 void timespec_add (struct timespec *, struct timespec *);
 
@@ -9,15 +9,22 @@
 #include <sys/wait.h>
 #include <semaphore.h>
 #include "common.h"
+#include "queuelib.h"
 
 #define BACKLOG_COUNT 100
+
+/* Longest head of the SJN queue printed after each request */
+#define SHOW_QUEUE_MAX 32
 #define USAGE_MSG \
     "Missing parameter. Exiting.\n" \
     "Usage: %s -q <queue size> " \
     "-w <workers> " \
     "-p <policy: FIFO | SJN> " \
+    "[-a <aging factor>] " \
     "<port_number>\n"
 
+/* Protect the heap used by the SJN policy. FIFO requests go through
+ * the lock-free ring and do not need them. */
 sem_t *qm;
 sem_t *qn;
 
@@ -34,19 +41,29 @@ enum queue_policy {
     SJN_POLICY
 };
 
+/* Entry of the SJN heap. Shorter keys are served first. */
+struct heap_node {
+    double key;
+    uint64_t seq;    /* Arrival order, breaks ties FIFO */
+    struct request_meta item;
+};
+
 struct queue {
-    size_t write_idx;
-    size_t read_idx;
     size_t capacity;
     size_t slots;
-    struct request_meta *items;
+    struct heap_node *heap;
+    uint64_t next_seq;
+    double aging;
+    struct timespec origin;
     enum queue_policy policy_type;
+    struct mpmc_queue ring;
 };
 
 struct connection_params {
     size_t q_size;
     size_t worker_cnt;
     enum queue_policy q_policy;
+    double aging;
 };
 
 struct worker_params {
@@ -61,50 +78,138 @@ enum worker_command {
     CMD_STOP
 };
 
-void queue_setup(struct queue *q, size_t size, enum queue_policy policy) {
-    q->read_idx = 0;
-    q->write_idx = 0;
+void queue_setup(struct queue *q, size_t size, enum queue_policy policy, double aging) {
     q->capacity = size;
-    q->items = (struct request_meta *)malloc(sizeof(struct request_meta) * q->capacity);
+    q->heap = NULL;
     q->slots = size;
     q->policy_type = policy;
+    q->next_seq = 0;
+    q->aging = aging;
+    clock_gettime(CLOCK_MONOTONIC, &q->origin);
+
+    if (policy == FIFO_POLICY) {
+        if (mpmc_init(&q->ring, size, sizeof(struct request_meta)) < 0) {
+            ERROR_INFO();
+            perror("Unable to allocate queue");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        q->heap = (struct heap_node *)malloc(sizeof(struct heap_node) * q->capacity);
+        if (!q->heap) {
+            ERROR_INFO();
+            perror("Unable to allocate queue");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void queue_free(struct queue *q)
+{
+    if (q->policy_type == FIFO_POLICY) {
+        mpmc_destroy(&q->ring);
+    } else {
+        free(q->heap);
+    }
+}
+
+/* Wake up all the workers waiting on the queue. Pending requests can
+ * still be dequeued. */
+void queue_close(struct queue *q, size_t workers)
+{
+    size_t i;
+
+    if (q->policy_type == FIFO_POLICY) {
+        mpmc_close(&q->ring);
+        return;
+    }
+
+    for (i = 0; i < workers; ++i) {
+        sem_post(qn);
+    }
+}
+
+/* Order of two heap nodes: 1 if a must be served before b */
+static int heap_before(struct heap_node *a, struct heap_node *b)
+{
+    if (a->key != b->key) {
+        return a->key < b->key;
+    }
+    return a->seq < b->seq;
+}
+
+static void heap_swap(struct heap_node *a, struct heap_node *b)
+{
+    struct heap_node tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+/* Same shape as Adjustup/Adjustdown in Hearp.h, on heap_node */
+static void heap_adjust_up(struct heap_node *a, size_t child)
+{
+    while (child > 0) {
+        size_t parent = (child - 1) / 2;
+        if (!heap_before(&a[child], &a[parent])) {
+            break;
+        }
+        heap_swap(&a[child], &a[parent]);
+        child = parent;
+    }
+}
+
+static void heap_adjust_down(struct heap_node *a, size_t size, size_t parent)
+{
+    size_t child = parent * 2 + 1;
+
+    while (child < size) {
+        if (child + 1 < size && heap_before(&a[child + 1], &a[child])) {
+            ++child;
+        }
+        if (!heap_before(&a[child], &a[parent])) {
+            break;
+        }
+        heap_swap(&a[child], &a[parent]);
+        parent = child;
+        child = parent * 2 + 1;
+    }
+}
+
+/* SJN key with aging. A waiting job gains <aging> seconds of priority
+ * per second spent in the queue, i.e. at time t its priority is
+ * length - aging * (t - recv_time). The t term is common to all the
+ * jobs in the queue, so comparing length + aging * recv_time gives the
+ * same order and the key never needs to be updated. */
+static double sjn_key(struct queue *q, struct request_meta *item)
+{
+    struct timespec waited = item->recv_time;
+
+    waited.tv_sec -= q->origin.tv_sec;
+    waited.tv_nsec -= q->origin.tv_nsec;
+    return TSPEC_TO_DOUBLE(item->req.req_length) + q->aging * TSPEC_TO_DOUBLE(waited);
 }
 
 int enqueue(struct request_meta item, struct queue *q)
 {
     int status = 0;
+    double key;
+
+    if (q->policy_type == FIFO_POLICY) {
+        return (mpmc_try_push(&q->ring, &item) == QUEUE_OK ? 0 : 1);
+    }
+
+    key = sjn_key(q, &item);
 
     sem_wait(qm);
 
     if (q->slots == 0) {
         status = 1;
     } else {
-        if (q->policy_type == FIFO_POLICY) {
-            q->items[q->write_idx] = item;
-            q->write_idx = (q->write_idx + 1) % q->capacity;
-        } else if (q->policy_type == SJN_POLICY) {
-            size_t i, pos;
-            size_t count = (q->write_idx + q->capacity - q->read_idx) % q->capacity;
-
-            pos = q->write_idx;
-            for (i = 0; i < count; ++i) {
-                size_t idx = (q->read_idx + i) % q->capacity;
-                if (timespec_cmp(&item.req.req_length, &q->items[idx].req.req_length) < 0) {
-                    pos = idx;
-                    break;
-                }
-            }
+        size_t size = q->capacity - q->slots;
 
-            size_t current = q->write_idx;
-            while (current != pos) {
-                size_t prev = (current == 0) ? q->capacity - 1 : current - 1;
-                q->items[current] = q->items[prev];
-                current = prev;
-            }
-
-            q->items[pos] = item;
-            q->write_idx = (q->write_idx + 1) % q->capacity;
-        }
+        q->heap[size].key = key;
+        q->heap[size].seq = q->next_seq++;
+        q->heap[size].item = item;
+        heap_adjust_up(q->heap, size);
 
         q->slots--;
 
@@ -116,37 +221,96 @@ int enqueue(struct request_meta item, struct queue *q)
     return status;
 }
 
-struct request_meta dequeue(struct queue *q)
+/* Returns 1 once the queue has been closed and drained */
+int dequeue(struct queue *q, struct request_meta *result)
 {
-    struct request_meta result;
+    size_t size;
+
+    if (q->policy_type == FIFO_POLICY) {
+        return (mpmc_pop(&q->ring, result) == QUEUE_OK ? 0 : 1);
+    }
+
     sem_wait(qn);
     sem_wait(qm);
 
-    result = q->items[q->read_idx];
-    q->read_idx = (q->read_idx + 1) % q->capacity;
-    q->slots++;
+    if (q->slots == q->capacity) {
+        /* Only woken up without a request when closing */
+        sem_post(qm);
+        return 1;
+    }
+
+    *result = q->heap[0].item;
+    size = q->capacity - ++q->slots;
+    if (size > 0) {
+        q->heap[0] = q->heap[size];
+        heap_adjust_down(q->heap, size, 0);
+    }
 
     sem_post(qm);
-    return result;
+    return 0;
+}
+
+static void print_queued_request(const void *elem, void *arg)
+{
+    const struct request_meta *item = (const struct request_meta *)elem;
+    int *printed = (int *)arg;
+
+    printf("%sR%ld", (*printed)++ ? "," : "", item->req.req_id);
 }
 
 void show_queue(struct queue *q)
 {
-    size_t i, count;
-    sem_wait(qm);
+    /* Heap positions that may hold the next request in service order */
+    size_t frontier[SHOW_QUEUE_MAX + 1];
+    uint64_t ids[SHOW_QUEUE_MAX];
+    size_t i, count, shown, nfront;
 
-    printf("Q:[");
+    if (q->policy_type == FIFO_POLICY) {
+        int printed = 0;
 
-    for (i = q->read_idx, count = 0; count < q->capacity - q->slots;
-         i = (i + 1) % q->capacity, ++count)
-    {
-        printf("R%ld%s", q->items[i].req.req_id,
-               ((count + 1 != q->capacity - q->slots) ? "," : ""));
+        printf("Q:[");
+        mpmc_for_each(&q->ring, print_queued_request, &printed);
+        printf("]\n");
+        return;
     }
 
-    printf("]\n");
+    /* Only the head of the queue is printed, in service order. The
+     * heap is walked best-first from the root, so the time spent
+     * under the lock does not grow with the length of the queue. */
+    sem_wait(qm);
+    count = q->capacity - q->slots;
+    shown = 0;
+    nfront = 0;
+    if (count > 0) {
+        frontier[nfront++] = 0;
+    }
+    while (shown < SHOW_QUEUE_MAX && nfront > 0) {
+        size_t best = 0, node;
+
+        for (i = 1; i < nfront; ++i) {
+            if (heap_before(&q->heap[frontier[i]], &q->heap[frontier[best]])) {
+                best = i;
+            }
+        }
+        node = frontier[best];
+        frontier[best] = frontier[--nfront];
+        ids[shown++] = q->heap[node].item.req.req_id;
 
+        /* Children come after their parent */
+        for (i = 2 * node + 1; i <= 2 * node + 2 && i < count; ++i) {
+            frontier[nfront++] = i;
+        }
+    }
     sem_post(qm);
+
+    printf("Q:[");
+    for (i = 0; i < shown; ++i) {
+        printf("R%ld%s", ids[i], ((i + 1 != shown) ? "," : ""));
+    }
+    if (count > shown) {
+        printf(",...+%zu", count - shown);
+    }
+    printf("]\n");
 }
 
 void *worker_thread(void *arg)
@@ -155,15 +319,13 @@ void *worker_thread(void *arg)
     struct worker_params *wp = (struct worker_params *)arg;
 
     clock_gettime(CLOCK_MONOTONIC, &current);
-    printf("[#WORKER#] %lf Worker Thread Alive!\n", dtotspec(current));
+    printf("[#WORKER#] %lf Worker Thread Alive!\n", TSPEC_TO_DOUBLE(current));
 
     while (!wp->done_flag) {
         struct request_meta req;
         struct response response;
 
-        req = dequeue(wp->q_ptr);
-
-        if (wp->done_flag) {
+        if (dequeue(wp->q_ptr, &req) || wp->done_flag) {
             break;
         }
 
@@ -178,11 +340,11 @@ void *worker_thread(void *arg)
         printf("T%d R%ld:%lf,%lf,%lf,%lf,%lf\n",
                wp->id,
                req.req.req_id,
-               dtotspec(req.req.req_timestamp),
-               dtotspec(req.req.req_length),
-               dtotspec(req.recv_time),
-               dtotspec(req.start_time),
-               dtotspec(req.finish_time)
+               TSPEC_TO_DOUBLE(req.req.req_timestamp),
+               TSPEC_TO_DOUBLE(req.req.req_length),
+               TSPEC_TO_DOUBLE(req.recv_time),
+               TSPEC_TO_DOUBLE(req.start_time),
+               TSPEC_TO_DOUBLE(req.finish_time)
         );
 
         show_queue(wp->q_ptr);
@@ -196,6 +358,7 @@ int manage_workers(enum worker_command cmd, size_t count, struct worker_params *
     static pthread_t *threads = NULL;
     static struct worker_params **wps = NULL;
     static int *thread_ids = NULL;
+    static struct queue *q = NULL;
 
     if (cmd == CMD_START) {
         size_t i;
@@ -209,6 +372,8 @@ int manage_workers(enum worker_command cmd, size_t count, struct worker_params *
             return EXIT_FAILURE;
         }
 
+        q = common_wp->q_ptr;
+
         for (i = 0; i < count; ++i) {
             thread_ids[i] = -1;
 
@@ -253,13 +418,7 @@ int manage_workers(enum worker_command cmd, size_t count, struct worker_params *
             wps[i]->done_flag = 1;
         }
 
-        for (i = 0; i < count; ++i) {
-            if (thread_ids[i] < 0) {
-                continue;
-            }
-
-            sem_post(qn);
-        }
+        queue_close(q, count);
 
         for (i = 0; i < count; ++i) {
             pthread_join(threads[i], NULL);
@@ -298,7 +457,7 @@ void process_connection(int sock_fd, struct connection_params params)
     int result;
 
     q = (struct queue *)malloc(sizeof(struct queue));
-    queue_setup(q, params.q_size, params.q_policy);
+    queue_setup(q, params.q_size, params.q_policy, params.aging);
 
     common_wp.socket_fd = sock_fd;
     common_wp.q_ptr = q;
@@ -326,9 +485,9 @@ void process_connection(int sock_fd, struct connection_params params)
                 send(sock_fd, &resp, sizeof(struct response), 0);
 
                 printf("X%ld:%lf,%lf,%lf\n", req_ptr->req.req_id,
-                       dtotspec(req_ptr->req.req_timestamp),
-                       dtotspec(req_ptr->req.req_length),
-                       dtotspec(req_ptr->recv_time)
+                       TSPEC_TO_DOUBLE(req_ptr->req.req_timestamp),
+                       TSPEC_TO_DOUBLE(req_ptr->req.req_length),
+                       TSPEC_TO_DOUBLE(req_ptr->recv_time)
                 );
             }
         }
@@ -336,6 +495,8 @@ void process_connection(int sock_fd, struct connection_params params)
 
     manage_workers(CMD_STOP, params.worker_cnt, NULL);
 
+    queue_free(q);
+    free(q);
     free(req_ptr);
     shutdown(sock_fd, SHUT_RDWR);
     close(sock_fd);
@@ -352,8 +513,9 @@ int main(int argc, char **argv) {
     conn_p.q_size = 0;
     conn_p.worker_cnt = 1;
     conn_p.q_policy = -1;
+    conn_p.aging = 0.0;
 
-    while((opt = getopt(argc, argv, "q:w:p:")) != -1) {
+    while((opt = getopt(argc, argv, "q:w:p:a:")) != -1) {
         switch (opt) {
         case 'q':
             conn_p.q_size = strtol(optarg, NULL, 10);
@@ -375,6 +537,15 @@ int main(int argc, char **argv) {
             }
             printf("INFO: setting queue policy = %s\n", optarg);
             break;
+        case 'a':
+            conn_p.aging = strtod(optarg, NULL);
+            if (conn_p.aging < 0) {
+                fprintf(stderr, "Invalid aging factor: %s\n", optarg);
+                fprintf(stderr, USAGE_MSG, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            printf("INFO: setting SJN aging factor = %lf\n", conn_p.aging);
+            break;
         default:
             fprintf(stderr, USAGE_MSG, argv[0]);
         }
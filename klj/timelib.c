@@ -31,7 +31,7 @@ uint64_t get_elapsed_busywait(long sec, long nsec)
 
     do {
         clock_gettime(CLOCK_MONOTONIC, &current_time);
-    } while (end_time.tv_sec > current_time.tv_sec || end_time.tv_nsec > current_time.tv_nsec);
+    } while (timespec_cmp(&end_time, &current_time) > 0);
 
     get_clocks(finish);
 
@@ -42,7 +42,7 @@ void timespec_add(struct timespec *a, struct timespec *b)
 {
     time_t carry_seconds = b->tv_sec;
     a->tv_nsec += b->tv_nsec;
-    if (a->tv_nsec > NANO_IN_SEC) {
+    if (a->tv_nsec >= NANO_IN_SEC) {
         carry_seconds += a->tv_nsec / NANO_IN_SEC;
         a->tv_nsec = a->tv_nsec % NANO_IN_SEC;
     }
@@ -73,7 +73,7 @@ uint64_t busywait_timespec(struct timespec delay)
 
     do {
         clock_gettime(CLOCK_MONOTONIC, &current_time);
-    } while (delay.tv_sec > current_time.tv_sec || delay.tv_nsec > current_time.tv_nsec);
+    } while (timespec_cmp(&delay, &current_time) > 0);
 
     get_clocks(finish);
 
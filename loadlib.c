@@ -0,0 +1,97 @@
+/*******************************************************************************
+* Open-Loop Load Generator Helpers
+*
+* Description:
+*     Implementation of the helpers declared in loadlib.h.
+*
+* Creation Date:
+*     October 19, 2026
+*
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "loadlib.h"
+
+#define LOAD_NANO_IN_SEC 1000000000L
+
+double load_elapsed(const struct timespec * start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void load_sleep_until(const struct timespec * start, double at)
+{
+	struct timespec when;
+
+	when.tv_sec = start->tv_sec + (time_t)at;
+	when.tv_nsec = start->tv_nsec + (long)((at - (time_t)at) * LOAD_NANO_IN_SEC);
+	if (when.tv_nsec >= LOAD_NANO_IN_SEC) {
+		when.tv_nsec -= LOAD_NANO_IN_SEC;
+		when.tv_sec++;
+	}
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &when, NULL) == EINTR);
+}
+
+int load_cmp_double(const void * a, const void * b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+double load_percentile(const double * sorted, long n, double q)
+{
+	long idx;
+
+	if (n == 0) {
+		return 0.0;
+	}
+	idx = (long)ceil(q * n) - 1;
+	return sorted[idx < 0 ? 0 : idx];
+}
+
+void load_summarize(double * lat, long n, struct load_summary * out)
+{
+	double sum = 0.0;
+	long i;
+
+	qsort(lat, n, sizeof(double), load_cmp_double);
+	for (i = 0; i < n; ++i) {
+		sum += lat[i];
+	}
+
+	out->count = n;
+	out->mean = (n ? sum / n : 0.0);
+	out->p50 = load_percentile(lat, n, 0.50);
+	out->p90 = load_percentile(lat, n, 0.90);
+	out->p99 = load_percentile(lat, n, 0.99);
+	out->p999 = load_percentile(lat, n, 0.999);
+	out->max = (n ? lat[n - 1] : 0.0);
+}
+
+long load_drain(volatile long * completed, long expected, double timeout)
+{
+	struct timespec last_progress;
+	long seen = -1, now;
+
+	clock_gettime(CLOCK_MONOTONIC, &last_progress);
+	while ((now = __atomic_load_n(completed, __ATOMIC_RELAXED)) < expected) {
+		if (now != seen) {
+			seen = now;
+			clock_gettime(CLOCK_MONOTONIC, &last_progress);
+		} else if (load_elapsed(&last_progress) > timeout) {
+			return expected - now;
+		}
+		usleep(1000);
+	}
+
+	return 0;
+}
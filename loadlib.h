@@ -0,0 +1,56 @@
+/*******************************************************************************
+* Open-Loop Load Generator Helpers (header)
+*
+* Description:
+*     Pieces shared by the open-loop clients (hw2224/client.c and
+*     11.07/hw7/client.c): sending on an absolute schedule, latency
+*     percentiles, and waiting for the last responses.
+*
+* Creation Date:
+*     October 19, 2026
+*
+* Notes:
+*     All times are in seconds from the start of the run, as doubles.
+*     Latency is measured from the scheduled send time, so a sender that
+*     falls behind does not hide queueing delay.
+*
+*******************************************************************************/
+
+#ifndef __LOADLIB_H__
+#define __LOADLIB_H__
+
+#include <time.h>
+
+/* Latency distribution of a set of completed requests */
+struct load_summary {
+	long count;
+	double mean;
+	double p50;
+	double p90;
+	double p99;
+	double p999;
+	double max;
+};
+
+/* Seconds elapsed since <start> (CLOCK_MONOTONIC) */
+double load_elapsed(const struct timespec * start);
+
+/* Sleep until <at> seconds after <start>; return at once if that
+ * time has already passed */
+void load_sleep_until(const struct timespec * start, double at);
+
+/* qsort comparator for doubles, ascending */
+int load_cmp_double(const void * a, const void * b);
+
+/* Value at quantile <q> of the <n> sorted values, 0 if there are none */
+double load_percentile(const double * sorted, long n, double q);
+
+/* Sort the <n> latencies in <lat> and fill in <out> */
+void load_summarize(double * lat, long n, struct load_summary * out);
+
+/* Wait until <*completed> reaches <expected>, giving up after
+ * <timeout> seconds without progress (servers do not answer dropped
+ * requests). Returns the number of responses still missing. */
+long load_drain(volatile long * completed, long expected, double timeout);
+
+#endif
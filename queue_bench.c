@@ -0,0 +1,287 @@
+/*******************************************************************************
+* Queue Microbenchmark
+*
+* Description:
+*     Compares the throughput of the lock-free MPMC queue in queuelib with
+*     the semaphore-protected circular queue previously used by the servers
+*     (one semaphore as mutex, one to notify consumers). Producers push
+*     request-sized items as fast as they can, retrying when the queue is
+*     full; consumers pop them and checksum the payload to make sure that
+*     nothing is lost or duplicated.
+*
+* Usage:
+*     <build directory>/queue_bench [-p <producers>] [-c <consumers>]
+*         [-n <items per producer>] [-q <queue size>]
+*
+* Creation Date:
+*     October 19, 2026
+*
+* Notes:
+*     Each run prints one line per queue type in the format
+*     <TYPE>: <items> items, <seconds> s, <Mops/s>, <retries on full>.
+*
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include "queuelib.h"
+
+#define USAGE_STRING						\
+	"Usage: %s [-p <producers>] [-c <consumers>] "		\
+	"[-n <items per producer>] [-q <queue size>]\n"
+
+/* Same size as struct request_meta in the servers */
+struct bench_item {
+	uint64_t value;
+	uint64_t producer;
+	struct timespec payload[3];
+};
+
+/* The circular queue the servers used before queuelib */
+struct sem_queue {
+	struct bench_item * items;
+	size_t front;
+	size_t size;
+	size_t capacity;
+	sem_t mutex;
+	sem_t notify;
+	int done;
+};
+
+struct bench_params {
+	int id;
+	size_t items;
+	int use_mpmc;
+	struct sem_queue * sq;
+	struct mpmc_queue * mq;
+	/* Results */
+	uint64_t checksum;
+	uint64_t retries;
+};
+
+int sem_queue_push(struct sem_queue * q, struct bench_item * item)
+{
+	int retval = 0;
+
+	sem_wait(&q->mutex);
+	if (q->size >= q->capacity) {
+		retval = 1;
+	} else {
+		q->items[(q->front + q->size) % q->capacity] = *item;
+		q->size++;
+		sem_post(&q->notify);
+	}
+	sem_post(&q->mutex);
+
+	return retval;
+}
+
+int sem_queue_pop(struct sem_queue * q, struct bench_item * item)
+{
+	int retval = 0;
+
+	sem_wait(&q->notify);
+	sem_wait(&q->mutex);
+	if (q->size == 0) {
+		/* Only happens when woken up for termination */
+		retval = 1;
+	} else {
+		*item = q->items[q->front];
+		q->front = (q->front + 1) % q->capacity;
+		q->size--;
+	}
+	sem_post(&q->mutex);
+
+	return retval;
+}
+
+void * producer_main(void * arg)
+{
+	struct bench_params * params = (struct bench_params *)arg;
+	struct bench_item item;
+	size_t i;
+	int full;
+
+	memset(&item, 0, sizeof(item));
+	item.producer = params->id;
+
+	for (i = 0; i < params->items; ++i) {
+		item.value = i + 1;
+		params->checksum += item.value;
+
+		for (;;) {
+			if (params->use_mpmc) {
+				full = (mpmc_try_push(params->mq, &item) != QUEUE_OK);
+			} else {
+				full = sem_queue_push(params->sq, &item);
+			}
+
+			if (!full) {
+				break;
+			}
+			params->retries++;
+			sched_yield();
+		}
+	}
+
+	return NULL;
+}
+
+void * consumer_main(void * arg)
+{
+	struct bench_params * params = (struct bench_params *)arg;
+	struct bench_item item;
+
+	for (;;) {
+		if (params->use_mpmc) {
+			if (mpmc_pop(params->mq, &item) != QUEUE_OK) {
+				break;
+			}
+		} else if (sem_queue_pop(params->sq, &item)) {
+			if (params->sq->done) {
+				break;
+			}
+			continue;
+		}
+		params->checksum += item.value;
+	}
+
+	return NULL;
+}
+
+/* Run one experiment and print its results. Returns 0 if all the
+ * items pushed were popped exactly once. */
+int run_bench(int use_mpmc, int producers, int consumers,
+	      size_t items, size_t capacity)
+{
+	struct sem_queue sq;
+	struct mpmc_queue mq;
+	struct bench_params * params;
+	pthread_t * threads;
+	struct timespec start, end;
+	uint64_t pushed = 0, popped = 0, retries = 0;
+	double elapsed;
+	int i, total = producers + consumers;
+
+	params = (struct bench_params *)calloc(total, sizeof(struct bench_params));
+	threads = (pthread_t *)malloc(total * sizeof(pthread_t));
+
+	if (use_mpmc) {
+		if (mpmc_init(&mq, capacity, sizeof(struct bench_item)) < 0) {
+			perror("Unable to allocate queue");
+			return -1;
+		}
+	} else {
+		sq.items = (struct bench_item *)malloc(capacity * sizeof(struct bench_item));
+		sq.front = 0;
+		sq.size = 0;
+		sq.capacity = capacity;
+		sq.done = 0;
+		sem_init(&sq.mutex, 0, 1);
+		sem_init(&sq.notify, 0, 0);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < total; ++i) {
+		params[i].id = i;
+		params[i].items = items;
+		params[i].use_mpmc = use_mpmc;
+		params[i].sq = &sq;
+		params[i].mq = &mq;
+		pthread_create(&threads[i], NULL,
+			       (i < consumers ? consumer_main : producer_main),
+			       &params[i]);
+	}
+
+	/* Wait for the producers, then let the consumers drain */
+	for (i = consumers; i < total; ++i) {
+		pthread_join(threads[i], NULL);
+		pushed += params[i].checksum;
+		retries += params[i].retries;
+	}
+
+	if (use_mpmc) {
+		mpmc_close(&mq);
+	} else {
+		sem_wait(&sq.mutex);
+		sq.done = 1;
+		sem_post(&sq.mutex);
+		for (i = 0; i < consumers; ++i) {
+			sem_post(&sq.notify);
+		}
+	}
+
+	for (i = 0; i < consumers; ++i) {
+		pthread_join(threads[i], NULL);
+		popped += params[i].checksum;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("%s: %lu items, %.6f s, %.3f Mops/s, %lu retries%s\n",
+	       (use_mpmc ? "MPMC" : "SEM"), (uint64_t)items * producers,
+	       elapsed, items * producers / elapsed / 1e6, retries,
+	       (pushed == popped ? "" : " (CHECKSUM MISMATCH)"));
+
+	if (use_mpmc) {
+		mpmc_destroy(&mq);
+	} else {
+		sem_destroy(&sq.mutex);
+		sem_destroy(&sq.notify);
+		free(sq.items);
+	}
+	free(params);
+	free(threads);
+
+	return (pushed == popped ? 0 : -1);
+}
+
+int main(int argc, char ** argv)
+{
+	int producers = 1, consumers = 1, opt, retval = 0;
+	size_t items = 1000000, capacity = 1000;
+
+	while ((opt = getopt(argc, argv, "p:c:n:q:")) != -1) {
+		switch (opt) {
+		case 'p':
+			producers = strtol(optarg, NULL, 10);
+			break;
+		case 'c':
+			consumers = strtol(optarg, NULL, 10);
+			break;
+		case 'n':
+			items = strtoul(optarg, NULL, 10);
+			break;
+		case 'q':
+			capacity = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, USAGE_STRING, argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (producers < 1 || consumers < 1 || !capacity) {
+		fprintf(stderr, USAGE_STRING, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	printf("INFO: %d producer(s), %d consumer(s), %lu items each, queue size %lu\n",
+	       producers, consumers, items, capacity);
+
+	retval |= run_bench(0, producers, consumers, items, capacity);
+	retval |= run_bench(1, producers, consumers, items, capacity);
+
+	return (retval ? EXIT_FAILURE : EXIT_SUCCESS);
+}
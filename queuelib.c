@@ -0,0 +1,344 @@
+/*******************************************************************************
+* Bounded MPMC Queue Library
+*
+* Description:
+*     Implementation of the bounded multi-producer/multi-consumer queue
+*     declared in queuelib.h.
+*
+* Creation Date:
+*     October 19, 2026
+*
+* Notes:
+*     Slot <i> of the ring is used by positions i, i + capacity,
+*     i + 2*capacity, ... Its sequence number is equal to the position
+*     when the slot is free for that position, and to position + 1 once
+*     the element has been written. Popping the element moves the
+*     sequence to position + capacity, i.e. frees the slot for the next
+*     lap. Producers and consumers claim positions with a CAS on tail and
+*     head respectively and never touch the same slot at the same time.
+*
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "queuelib.h"
+
+/* How many times to poll an empty queue before going to sleep */
+#define QUEUE_SPIN 64
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() atomic_signal_fence(memory_order_seq_cst)
+#endif
+
+/* Every slot starts with its sequence number, followed by the
+ * element. Slots are padded to keep 64-bit fields aligned. */
+#define cell_seq(q, pos)						\
+	((atomic_size_t *)((q)->cells + ((pos) % (q)->capacity) * (q)->cell_size))
+#define cell_data(q, pos)						\
+	((void *)((q)->cells + ((pos) % (q)->capacity) * (q)->cell_size	\
+		  + sizeof(atomic_size_t)))
+
+static long futex(atomic_uint * addr, int op, unsigned int val,
+		  const struct timespec * timeout)
+{
+	return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+int mpmc_init(struct mpmc_queue * q, size_t capacity, size_t elem_size)
+{
+	size_t i;
+
+	if (!capacity) {
+		return -1;
+	}
+
+	q->capacity = capacity;
+	q->elem_size = elem_size;
+	q->cell_size = (sizeof(atomic_size_t) + elem_size + 7) & ~(size_t)7;
+	q->cells = (unsigned char *)aligned_alloc(QUEUE_CACHELINE,
+		   ((capacity * q->cell_size + QUEUE_CACHELINE - 1) / QUEUE_CACHELINE)
+		   * QUEUE_CACHELINE);
+
+	if (!q->cells) {
+		return -1;
+	}
+
+	for (i = 0; i < capacity; ++i) {
+		atomic_init(cell_seq(q, i), i);
+	}
+
+	atomic_init(&q->tail, 0);
+	atomic_init(&q->head, 0);
+	atomic_init(&q->epoch, 0);
+	atomic_init(&q->waiters, 0);
+	atomic_init(&q->closed, 0);
+
+	return 0;
+}
+
+void mpmc_destroy(struct mpmc_queue * q)
+{
+	free(q->cells);
+	q->cells = NULL;
+}
+
+int mpmc_try_push(struct mpmc_queue * q, const void * elem)
+{
+	size_t pos, seq;
+	intptr_t diff;
+
+	pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	for (;;) {
+		seq = atomic_load_explicit(cell_seq(q, pos), memory_order_acquire);
+		diff = (intptr_t)seq - (intptr_t)pos;
+
+		if (diff == 0) {
+			/* Slot is free for this lap: try to claim it */
+			if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+								  memory_order_relaxed,
+								  memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			/* Slot still holds the element of the previous lap */
+			return QUEUE_FULL;
+		} else {
+			/* Another producer got here first */
+			pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+		}
+	}
+
+	memcpy(cell_data(q, pos), elem, q->elem_size);
+	atomic_store_explicit(cell_seq(q, pos), pos + 1, memory_order_release);
+
+	/* Bump the event count after publishing the element, then look
+	 * for sleepers. Pairs with the waiters/epoch sequence in
+	 * pop_wait() so that a wakeup cannot be lost. */
+	atomic_fetch_add(&q->epoch, 1);
+	if (atomic_load(&q->waiters)) {
+		futex(&q->epoch, FUTEX_WAKE_PRIVATE, 1, NULL);
+	}
+
+	return QUEUE_OK;
+}
+
+int mpmc_try_pop(struct mpmc_queue * q, void * out)
+{
+	size_t pos, seq;
+	intptr_t diff;
+
+	pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+	for (;;) {
+		seq = atomic_load_explicit(cell_seq(q, pos), memory_order_acquire);
+		diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+								  memory_order_relaxed,
+								  memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			/* Nothing written at this position yet */
+			return QUEUE_EMPTY;
+		} else {
+			pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+		}
+	}
+
+	memcpy(out, cell_data(q, pos), q->elem_size);
+	atomic_store_explicit(cell_seq(q, pos), pos + q->capacity, memory_order_release);
+
+	return QUEUE_OK;
+}
+
+int mpmc_try_pop_if(struct mpmc_queue * q, void * out,
+		    int (*pred)(const void * elem, void * arg), void * arg)
+{
+	size_t pos;
+
+	pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+	for (;;) {
+		if (atomic_load_explicit(cell_seq(q, pos), memory_order_acquire) != pos + 1) {
+			size_t now = atomic_load_explicit(&q->head, memory_order_relaxed);
+			if (now == pos) {
+				return QUEUE_EMPTY;
+			}
+			pos = now;
+			continue;
+		}
+
+		/* Look at the element before claiming it, as in
+		 * mpmc_for_each. If the CAS below succeeds nobody has
+		 * popped this position, so the slot was not recycled
+		 * while we copied it. */
+		memcpy(out, cell_data(q, pos), q->elem_size);
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(cell_seq(q, pos), memory_order_relaxed) != pos + 1) {
+			pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+			continue;
+		}
+
+		if (!pred(out, arg)) {
+			return QUEUE_EMPTY;
+		}
+
+		if (atomic_compare_exchange_strong_explicit(&q->head, &pos, pos + 1,
+							    memory_order_relaxed,
+							    memory_order_relaxed)) {
+			break;
+		}
+	}
+
+	atomic_store_explicit(cell_seq(q, pos), pos + q->capacity, memory_order_release);
+
+	return QUEUE_OK;
+}
+
+/* Subtract <b> from <a>, returning 0 if <b> is later than <a> */
+static int timespec_left(struct timespec * left, const struct timespec * a,
+			 const struct timespec * b)
+{
+	left->tv_sec = a->tv_sec - b->tv_sec;
+	left->tv_nsec = a->tv_nsec - b->tv_nsec;
+	if (left->tv_nsec < 0) {
+		left->tv_nsec += 1000000000L;
+		left->tv_sec--;
+	}
+	return (left->tv_sec >= 0);
+}
+
+/* Common body of the blocking pops. <timeout> is NULL to wait
+ * forever. */
+static int pop_wait(struct mpmc_queue * q, void * out,
+		    const struct timespec * timeout)
+{
+	struct timespec deadline, now, left;
+	unsigned int epoch;
+	int i;
+
+	if (timeout) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout->tv_sec;
+		deadline.tv_nsec += timeout->tv_nsec;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_nsec -= 1000000000L;
+			deadline.tv_sec++;
+		}
+	}
+
+	for (;;) {
+		/* Short poll first: if the producer is active, this
+		 * saves two system calls per element */
+		for (i = 0; i < QUEUE_SPIN; ++i) {
+			if (mpmc_try_pop(q, out) == QUEUE_OK) {
+				return QUEUE_OK;
+			}
+			cpu_relax();
+		}
+
+		if (atomic_load(&q->closed)) {
+			return (mpmc_try_pop(q, out) == QUEUE_OK ? QUEUE_OK : QUEUE_CLOSED);
+		}
+
+		/* Announce ourselves, then re-check the queue. A push
+		 * that completes after the re-check bumps the epoch we
+		 * sampled, so the futex wait returns right away. */
+		atomic_fetch_add(&q->waiters, 1);
+		epoch = atomic_load(&q->epoch);
+
+		if (mpmc_try_pop(q, out) == QUEUE_OK) {
+			atomic_fetch_sub(&q->waiters, 1);
+			return QUEUE_OK;
+		}
+
+		if (atomic_load(&q->closed)) {
+			atomic_fetch_sub(&q->waiters, 1);
+			continue;
+		}
+
+		if (timeout) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (!timespec_left(&left, &deadline, &now)) {
+				atomic_fetch_sub(&q->waiters, 1);
+				return QUEUE_TIMEOUT;
+			}
+			futex(&q->epoch, FUTEX_WAIT_PRIVATE, epoch, &left);
+		} else {
+			futex(&q->epoch, FUTEX_WAIT_PRIVATE, epoch, NULL);
+		}
+
+		atomic_fetch_sub(&q->waiters, 1);
+	}
+}
+
+int mpmc_pop(struct mpmc_queue * q, void * out)
+{
+	return pop_wait(q, out, NULL);
+}
+
+int mpmc_pop_timed(struct mpmc_queue * q, void * out,
+		   const struct timespec * timeout)
+{
+	return pop_wait(q, out, timeout);
+}
+
+void mpmc_close(struct mpmc_queue * q)
+{
+	atomic_store(&q->closed, 1);
+	atomic_fetch_add(&q->epoch, 1);
+	futex(&q->epoch, FUTEX_WAKE_PRIVATE, INT_MAX, NULL);
+}
+
+size_t mpmc_size(struct mpmc_queue * q)
+{
+	size_t head, tail;
+
+	/* Read head first: it can only move towards tail */
+	head = atomic_load(&q->head);
+	tail = atomic_load(&q->tail);
+
+	if (tail <= head) {
+		return 0;
+	}
+	return (tail - head > q->capacity ? q->capacity : tail - head);
+}
+
+size_t mpmc_for_each(struct mpmc_queue * q,
+		     void (*fn)(const void * elem, void * arg), void * arg)
+{
+	unsigned char copy[q->elem_size];
+	size_t pos, tail, count = 0;
+
+	pos = atomic_load(&q->head);
+	tail = atomic_load(&q->tail);
+
+	for (; pos < tail; ++pos) {
+		/* Copy the element out, then make sure the slot was not
+		 * recycled under our feet, seqlock style */
+		if (atomic_load_explicit(cell_seq(q, pos), memory_order_acquire) != pos + 1) {
+			continue;
+		}
+
+		memcpy(copy, cell_data(q, pos), q->elem_size);
+		atomic_thread_fence(memory_order_acquire);
+
+		if (atomic_load_explicit(cell_seq(q, pos), memory_order_relaxed) != pos + 1) {
+			continue;
+		}
+
+		fn(copy, arg);
+		++count;
+	}
+
+	return count;
+}
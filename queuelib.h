@@ -0,0 +1,105 @@
+/*******************************************************************************
+* Bounded MPMC Queue Library (header)
+*
+* Description:
+*     A bounded multi-producer/multi-consumer FIFO queue built on atomics,
+*     shared by all the queue-based servers. Each slot carries a sequence
+*     number that tells producers and consumers whether the slot is free
+*     or full for the current lap around the ring, so pushes and pops
+*     only contend on a single compare-and-swap. Consumers that find the
+*     queue empty block on a futex instead of a semaphore.
+*
+* Creation Date:
+*     October 19, 2026
+*
+* Notes:
+*     The queue stores copies of fixed-size elements. The capacity does not
+*     need to be a power of two, so it can be used directly as the -q limit
+*     of the servers: a push fails exactly when <capacity> elements are
+*     queued.
+*
+*******************************************************************************/
+
+#ifndef __QUEUELIB_H__
+#define __QUEUELIB_H__
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/* Return codes of the queue operations */
+#define QUEUE_OK       0
+#define QUEUE_FULL     1
+#define QUEUE_EMPTY    1
+#define QUEUE_CLOSED   2
+#define QUEUE_TIMEOUT  3
+
+/* Keep producer and consumer indexes on different cache lines */
+#define QUEUE_CACHELINE 64
+
+struct mpmc_queue {
+	/* Read-mostly part: layout of the ring */
+	unsigned char * cells;
+	size_t capacity;
+	size_t elem_size;
+	size_t cell_size;
+
+	/* Next position to push into */
+	_Alignas(QUEUE_CACHELINE) atomic_size_t tail;
+
+	/* Next position to pop from */
+	_Alignas(QUEUE_CACHELINE) atomic_size_t head;
+
+	/* Event count used to put consumers to sleep when the queue
+	 * is empty. Bumped on every push and on close. */
+	_Alignas(QUEUE_CACHELINE) atomic_uint epoch;
+	atomic_uint waiters;
+	atomic_int closed;
+};
+
+/* Allocate a queue of <capacity> elements of <elem_size> bytes
+ * each. Returns 0 on success, -1 if out of memory. */
+int mpmc_init(struct mpmc_queue * q, size_t capacity, size_t elem_size);
+
+/* Release the memory of the queue. No thread may be using it. */
+void mpmc_destroy(struct mpmc_queue * q);
+
+/* Copy <elem> at the end of the queue and wake up one waiting
+ * consumer. Returns QUEUE_OK or QUEUE_FULL. */
+int mpmc_try_push(struct mpmc_queue * q, const void * elem);
+
+/* Copy the element at the head of the queue into <out> without
+ * blocking. Returns QUEUE_OK or QUEUE_EMPTY. */
+int mpmc_try_pop(struct mpmc_queue * q, void * out);
+
+/* Same as mpmc_try_pop, but only pop the head element if <pred>
+ * returns non-zero on a copy of it. Returns QUEUE_OK, or QUEUE_EMPTY
+ * if the queue is empty or its head element was left in place. */
+int mpmc_try_pop_if(struct mpmc_queue * q, void * out,
+		    int (*pred)(const void * elem, void * arg), void * arg);
+
+/* Same as mpmc_try_pop but wait for an element if the queue is
+ * empty. Returns QUEUE_OK, or QUEUE_CLOSED once the queue has been
+ * closed and drained. */
+int mpmc_pop(struct mpmc_queue * q, void * out);
+
+/* Same as mpmc_pop but give up after waiting for <timeout>
+ * (relative). Returns QUEUE_OK, QUEUE_CLOSED or QUEUE_TIMEOUT. */
+int mpmc_pop_timed(struct mpmc_queue * q, void * out,
+		   const struct timespec * timeout);
+
+/* Mark the queue as closed and wake up every waiting consumer.
+ * Elements still in the queue can be popped. */
+void mpmc_close(struct mpmc_queue * q);
+
+/* Number of elements currently in the queue. Only a snapshot, as
+ * other threads may push or pop concurrently. */
+size_t mpmc_size(struct mpmc_queue * q);
+
+/* Invoke <fn> on a copy of each element in the queue, from head to
+ * tail, without stopping producers and consumers. Elements popped
+ * while walking are skipped. Returns the number of elements visited. */
+size_t mpmc_for_each(struct mpmc_queue * q,
+		     void (*fn)(const void * elem, void * arg), void * arg);
+
+#endif
@@ -53,23 +53,24 @@
  * included by both client and server */
 #include "common.h"
 
+/* Lock-free queue shared by all the servers */
+#include "queuelib.h"
+
 #define BACKLOG_COUNT 100
 #define USAGE_STRING				\
 	"Missing parameter. Exiting.\n"		\
 	"Usage: %s -q <queue size> <port_number>\n"
 
 
-/* START - Variables needed to protect the shared queue. DO NOT TOUCH */
-sem_t * queue_mutex;
-sem_t * queue_notify;
-/* END - Variables needed to protect the shared queue. DO NOT TOUCH */
+/* Request as stored in the queue, with its receipt timestamp */
+struct request_meta {
+	struct request req;
+	struct timespec receipt_ts;
+};
+
 struct queue {
-    /* MY IMPLEMENTATION  */
-	struct request_meta *requests;
-    int front;
-    int rear;
-    int size;
-    int capacity;
+	/* MY IMPLEMENTATION */
+	struct mpmc_queue ring;
 };
 
 struct worker_params {
@@ -82,92 +83,56 @@ struct worker_params {
 /* Helper function to perform queue initialization */
 void queue_init(struct queue * the_queue, size_t queue_size)
 {
-	/* MY IMPLEMENTATION with recurring queue*/
-    the_queue->requests = (struct request_meta *)malloc(queue_size * sizeof(struct request_meta));
-    the_queue->front = 0;
-    the_queue->rear = -1;
-    the_queue->size = 0;
-    the_queue->capacity = queue_size;
+	if (mpmc_init(&the_queue->ring, queue_size, sizeof(struct request_meta)) < 0) {
+		ERROR_INFO();
+		perror("Unable to allocate queue");
+		exit(EXIT_FAILURE);
+	}
 }
 
 /* Add a new request <request> to the shared queue <the_queue> */
 int add_to_queue(struct request to_add, struct queue * the_queue, struct timespec rec_timestamp)
 {
-	int retval = 0;
-	/* QUEUE PROTECTION INTRO START --- DO NOT TOUCH */
-	sem_wait(queue_mutex);
-	/* QUEUE PROTECTION INTRO END --- DO NOT TOUCH */
+	struct request_meta item;
+
+	item.req = to_add;
+	item.receipt_ts = rec_timestamp;
 
-	/* MY IMPLEMENTATION */
 	/* Make sure that the queue is not full */
-	if (the_queue->size >= the_queue->capacity) {
-		retval = -1;
-	}
-	else
-	{
-		/* If all good, add the item in the queue */
-		the_queue->rear = (the_queue->rear + 1) % the_queue->capacity;
-		the_queue->requests[the_queue->rear].req = to_add;
-		the_queue->requests[the_queue->rear].receipt_ts= rec_timestamp;
-		the_queue->size++;
-		/* QUEUE SIGNALING FOR CONSUMER --- DO NOT TOUCH */
-		sem_post(queue_notify);
+	if (mpmc_try_push(&the_queue->ring, &item) != QUEUE_OK) {
+		return -1;
 	}
+	return 0;
+}
 
-	/* QUEUE PROTECTION OUTRO START --- DO NOT TOUCH */
-	sem_post(queue_mutex);
-	/* QUEUE PROTECTION OUTRO END --- DO NOT TOUCH */
-	return retval;
+/* Get a request from the shared queue <the_queue>, waiting for one
+ * if it is empty. Returns -1 when the queue has been closed and
+ * drained. */
+int get_from_queue(struct queue * the_queue, struct request_meta * out)
+{
+	if (mpmc_pop(&the_queue->ring, out) != QUEUE_OK) {
+		return -1;
+	}
+	return 0;
 }
 
-/* Add a new request <request> to the shared queue <the_queue> */
-struct request_meta get_from_queue(struct queue * the_queue)
+static void print_queued_request(const void * elem, void * arg)
 {
-	struct request_meta retval;
-	/* QUEUE PROTECTION INTRO START --- DO NOT TOUCH */
-	sem_wait(queue_notify);
-	sem_wait(queue_mutex);
-	/* QUEUE PROTECTION INTRO END --- DO NOT TOUCH */
+	const struct request_meta * item = (const struct request_meta *)elem;
+	int * printed = (int *)arg;
 
-	/* MY IMPLEMENTATION */
-	if (the_queue->size == 0) {
-		retval.req.req_id = -1;
-		return retval;
-	}
-	retval = the_queue->requests[the_queue->front];
-	the_queue->front = (the_queue->front + 1) % the_queue->capacity;
-	the_queue->size--;
-
-	/* QUEUE PROTECTION OUTRO START --- DO NOT TOUCH */
-	sem_post(queue_mutex);
-	/* QUEUE PROTECTION OUTRO END --- DO NOT TOUCH */
-	return retval;
+	printf("%sR%ld", (*printed)++ ? "," : "", item->req.req_id);
 }
 
 /* Implement this method to correctly dump the status of the queue
  * following the format Q:[R<request ID>,R<request ID>,...] */
 void dump_queue_status(struct queue * the_queue)
 {
-	int i;
-	/* QUEUE PROTECTION INTRO START --- DO NOT TOUCH */
-	sem_wait(queue_mutex);
-	/* QUEUE PROTECTION INTRO END --- DO NOT TOUCH */
+	int printed = 0;
 
-	/* MY IMPLEMENTATION */
 	printf("Q:[");
-	for (i = 0; i < the_queue->size; i++) 
-	{
-		int index = (the_queue->front + i) % the_queue->capacity;
-		printf("R%ld", the_queue->requests[index].req.req_id);
-		if (i < the_queue->size - 1)
-		{
-			printf(",");
-		}
-	}
+	mpmc_for_each(&the_queue->ring, print_queued_request, &printed);
 	printf("]\n");
-	/* QUEUE PROTECTION OUTRO START --- DO NOT TOUCH */
-	sem_post(queue_mutex);
-	/* QUEUE PROTECTION OUTRO END --- DO NOT TOUCH */
 }
 
 
@@ -176,19 +141,15 @@ void* worker_main(void *arg)
 {
     struct worker_params *iota = (struct worker_params *)arg;
     struct queue *the_queue = iota->the_queue;
-    int *terminate = iota->terminate;
+    struct request_meta req;
 	struct timespec start_timestamp, completion_timestamp;
     struct timespec now;
     clock_gettime(CLOCK_MONOTONIC, &now);
 	printf("[#WORKER#] %lf Worker Thread Alive!\n", TSPEC_TO_DOUBLE(now));
     
-    while (!*terminate) {
-        struct request_meta req = get_from_queue(iota->the_queue);
-
-		if(req.req.req_id == -1) {
-			continue;
-		}
-		
+    /* Requests still queued when we are asked to terminate are
+     * dropped, as they always were */
+    while (get_from_queue(the_queue, &req) == 0 && !*iota->terminate) {
         clock_gettime(CLOCK_MONOTONIC, &start_timestamp);
 
         struct response resp;
@@ -231,13 +192,13 @@ void handle_connection(int socket, size_t queue_size)
 	queue_init(the_queue, queue_size);
 
 	/* Queue ready to go here. Let's start the worker thread. */
-	int terminate = 0;
 	pthread_t worker_thread;
+	int terminate = 0;
 	struct worker_params params = {the_queue, &socket, &terminate};
 
     // Create the worker thread
     if (pthread_create(&worker_thread, NULL, worker_main, &params) != 0) {
-        free(the_queue->requests);
+        mpmc_destroy(&the_queue->ring);
         free(the_queue);
         close(socket);
         return;
@@ -283,17 +244,16 @@ void handle_connection(int socket, size_t queue_size)
 
 	/* PERFORM ORDERLY DEALLOCATION AND OUTRO HERE */
 	
-	/* Ask the worker thead to terminate */
-	/* ASSERT TERMINATION FLAG FOR THE WORKER THREAD */
+	/* Ask the worker thead to terminate, waking it up if it is
+	 * stuck waiting for items in the queue */
 	terminate = 1;
-	/* Make sure to wake-up any thread left stuck waiting for items in the queue. DO NOT TOUCH */
-	sem_post(queue_notify);
+	mpmc_close(&the_queue->ring);
 
 	/* Wait for orderly termination of the worker thread */	
 	pthread_join(worker_thread, NULL);
 
 	free(req);
-    free(the_queue->requests);
+    mpmc_destroy(&the_queue->ring);
     free(the_queue);
     
     close(socket);
@@ -377,29 +337,9 @@ int main (int argc, char ** argv) {
 		return EXIT_FAILURE;
 	}
 
-	/* Initialize queue protection variables. DO NOT TOUCH. */
-	queue_mutex = (sem_t *)malloc(sizeof(sem_t));
-	queue_notify = (sem_t *)malloc(sizeof(sem_t));
-	retval = sem_init(queue_mutex, 0, 1);
-	if (retval < 0) {
-		ERROR_INFO();
-		perror("Unable to initialize queue mutex");
-		return EXIT_FAILURE;
-	}
-	retval = sem_init(queue_notify, 0, 0);
-	if (retval < 0) {
-		ERROR_INFO();
-		perror("Unable to initialize queue notify");
-		return EXIT_FAILURE;
-	}
-	/* DONE - Initialize queue protection variables. DO NOT TOUCH */
-
 	/* Ready to handle the new connection with the client. */
 	handle_connection(accepted, queue_size);
 
-	free(queue_mutex);
-	free(queue_notify);
-
 	close(sockfd);
 	return EXIT_SUCCESS;
 
@@ -17,6 +17,9 @@
  * included by both client and server */
 #include "common.h"
 
+/* Lock-free queue shared by all the servers */
+#include "queuelib.h"
+
 #define BACKLOG_COUNT 100
 #define USAGE_STRING \
     "Missing parameter. Exiting.\n" \
@@ -33,11 +36,6 @@ sem_t *print_mutex;
         sem_post(print_mutex);   \
     } while (0)
 
-/* START - Variables needed to protect the shared queue. DO NOT TOUCH */
-sem_t *queue_lock;
-sem_t *queue_signal;
-/* END - Variables needed to protect the shared queue. DO NOT TOUCH */
-
 struct request_info {
     struct request request_data;
     struct timespec receive_time;    // Time when the request was received
@@ -45,107 +43,61 @@ struct request_info {
     struct timespec process_end;     // Time when processing completes
 };
 
-struct circular_queue {
-    struct request_info *request_array;
-    int head;
-    int tail;
-    int current_size;
-    int max_size;
-};
-
 struct connection_settings {
     size_t queue_capacity;
     size_t num_workers;
 };
 
 struct worker_args {
-    struct circular_queue *shared_queue; // Shared queue between worker threads and parent
+    struct mpmc_queue *shared_queue; // Shared queue between worker threads and parent
     int connection_fd;
     int worker_id;
-    volatile int *stop_flag;
 };
 
-void initialize_queue(struct circular_queue *queue_ptr, size_t capacity)
+/* Set when the client goes away. Workers stop after their current
+ * request and drop whatever is still queued. */
+int termination_flag = 0;
+
+void initialize_queue(struct mpmc_queue *queue_ptr, size_t capacity)
 {
-    queue_ptr->request_array = (struct request_info *)malloc(capacity * sizeof(struct request_info));
-    if (queue_ptr->request_array == NULL) {
+    if (mpmc_init(queue_ptr, capacity, sizeof(struct request_info)) < 0) {
         perror("Failed to allocate memory for the queue");
         exit(EXIT_FAILURE);
     }
-
-    queue_ptr->head = 0;
-    queue_ptr->tail = 0;
-    queue_ptr->current_size = 0;
-    queue_ptr->max_size = capacity;
 }
 
-int enqueue_request(struct request_info new_request, struct circular_queue *queue_ptr)
+/* Returns 1 if the queue is full and the request must be rejected */
+int enqueue_request(struct request_info new_request, struct mpmc_queue *queue_ptr)
 {
-    int result = 0;
-    /* QUEUE PROTECTION INTRO START --- DO NOT TOUCH */
-    sem_wait(queue_lock);
-    /* QUEUE PROTECTION INTRO END --- DO NOT TOUCH */
-
-    /* Ensure the queue is not full */
-    if (queue_ptr->current_size >= queue_ptr->max_size) {
-        /* Queue is full */
-        result = 1;
-    } else {
-        /* Add the item to the queue */
-        queue_ptr->request_array[queue_ptr->tail] = new_request;
-        queue_ptr->tail = (queue_ptr->tail + 1) % queue_ptr->max_size;
-        queue_ptr->current_size++;
-        /* QUEUE SIGNALING FOR CONSUMER --- DO NOT TOUCH */
-        result = 0;
-        sem_post(queue_signal);
-    }
+    return (mpmc_try_push(queue_ptr, &new_request) == QUEUE_OK ? 0 : 1);
+}
 
-    /* QUEUE PROTECTION OUTRO START --- DO NOT TOUCH */
-    sem_post(queue_lock);
-    /* QUEUE PROTECTION OUTRO END --- DO NOT TOUCH */
-    return result;
+/* Blocks until a request is available. Returns 1 once the queue has
+ * been closed and drained, i.e. when the worker should exit. */
+int dequeue_request(struct mpmc_queue *queue_ptr, struct request_info *result)
+{
+    return (mpmc_pop(queue_ptr, result) == QUEUE_OK ? 0 : 1);
 }
 
-struct request_info dequeue_request(struct circular_queue *queue_ptr)
+static void print_queued_request(const void *elem, void *arg)
 {
-    struct request_info result;
-    /* QUEUE PROTECTION INTRO START --- DO NOT TOUCH */
-    sem_wait(queue_signal);
-    sem_wait(queue_lock);
-    /* QUEUE PROTECTION INTRO END --- DO NOT TOUCH */
-
-    result = queue_ptr->request_array[queue_ptr->head];
-    queue_ptr->head = (queue_ptr->head + 1) % queue_ptr->max_size;
-    queue_ptr->current_size--;
-
-    /* QUEUE PROTECTION OUTRO START --- DO NOT TOUCH */
-    sem_post(queue_lock);
-    /* QUEUE PROTECTION OUTRO END --- DO NOT TOUCH */
-    return result;
+    const struct request_info *req_info = (const struct request_info *)elem;
+    int *printed = (int *)arg;
+
+    printf("%sR%ld", (*printed)++ ? "," : "", req_info->request_data.req_id);
 }
 
-void display_queue_status(struct circular_queue *queue_ptr)
+void display_queue_status(struct mpmc_queue *queue_ptr)
 {
-    /* QUEUE PROTECTION INTRO START --- DO NOT TOUCH */
-    sem_wait(queue_lock);
-    /* QUEUE PROTECTION INTRO END --- DO NOT TOUCH */
+    int printed = 0;
 
+    sem_wait(print_mutex);
     printf("Q:[");
-    for (int i = 0; i < queue_ptr->current_size; i++) {
-        int index = (queue_ptr->head + i) % queue_ptr->max_size;
-        printf("R%ld", queue_ptr->request_array[index].request_data.req_id);
-        if (i < queue_ptr->current_size - 1) {
-            printf(",");
-        }
-    }
+    mpmc_for_each(queue_ptr, print_queued_request, &printed);
     printf("]\n");
-
-    /* QUEUE PROTECTION OUTRO START --- DO NOT TOUCH */
-    sem_post(queue_lock);
-    /* QUEUE PROTECTION OUTRO END --- DO NOT TOUCH */
+    sem_post(print_mutex);
 }
 
-int termination_flag = 0;
 /* Main logic of the worker thread */
 void *worker_thread_main(void *arg)
 {
@@ -156,14 +108,9 @@ void *worker_thread_main(void *arg)
     clock_gettime(CLOCK_MONOTONIC, &current_time);
     sync_printf("[#WORKER#] %lf Worker Thread Alive!\n", TSPEC_TO_DOUBLE(current_time));
 
-    /* Main worker logic */
-    while (termination_flag != 1) {
-        struct request_info req_info = dequeue_request(args->shared_queue);
-
-        if (args->shared_queue->current_size < 0) {
-            continue;
-        }
-
+    /* Main worker logic: run until asked to terminate */
+    struct request_info req_info;
+    while (dequeue_request(args->shared_queue, &req_info) == 0 && !termination_flag) {
         /* Record start time */
         clock_gettime(CLOCK_MONOTONIC, &req_info.process_start);
 
@@ -199,17 +146,18 @@ void *worker_thread_main(void *arg)
 /* This function will control all the workers (start or stop them). */
 int manage_workers(int command, size_t num_workers, struct worker_args *worker_params, pthread_t *worker_threads)
 {
+    /* Starting or stopping, all the workers share the same queue */
+    struct mpmc_queue *queue_ptr = worker_params[0].shared_queue;
+
     if (command == 0) { // Starting all the workers
+        termination_flag = 0;
         for (int i = 0; i < num_workers; i++) {
             pthread_create(&worker_threads[i], NULL, worker_thread_main, &worker_params[i]);
         }
     } else { // Stopping all the workers
+        /* Wake up any threads blocked on the queue */
         termination_flag = 1;
-
-        /* Wake up any threads blocked on semaphores */
-        for (int j = 0; j < num_workers; j++) {
-            sem_post(queue_signal);
-        }
+        mpmc_close(queue_ptr);
         for (int k = 0; k < num_workers; k++) {
             pthread_join(worker_threads[k], NULL);
         }
@@ -221,9 +169,9 @@ int manage_workers(int command, size_t num_workers, struct worker_args *worker_p
 void handle_client_connection(int client_socket, struct connection_settings conn_settings)
 {
     struct request_info *req_info = malloc(sizeof(struct request_info));
-    size_t received_bytes;
+    ssize_t received_bytes;
 
-    struct circular_queue *queue_ptr = malloc(sizeof(struct circular_queue));
+    struct mpmc_queue *queue_ptr = malloc(sizeof(struct mpmc_queue));
 
     initialize_queue(queue_ptr, conn_settings.queue_capacity);
 
@@ -244,7 +192,7 @@ void handle_client_connection(int client_socket, struct connection_settings conn
 
     do {
         /* Receive the next request */
-        int received_bytes = recv(client_socket, &(req_info->request_data), sizeof(struct request), 0);
+        received_bytes = recv(client_socket, &(req_info->request_data), sizeof(struct request), 0);
         if (received_bytes <= 0) {
             break;
         }
@@ -281,16 +229,11 @@ void handle_client_connection(int client_socket, struct connection_settings conn
     } while (received_bytes > 0);
 
     /* Terminate worker threads */
-    termination_flag = 1;
-    /* Unblock all worker threads */
-    for (int i = 0; i < conn_settings.num_workers; i++) {
-        sem_post(queue_signal);
-    }
     manage_workers(1, conn_settings.num_workers, worker_params, worker_threads);
 
     /* Clean up */
     free(req_info);
-    free(queue_ptr->request_array);
+    mpmc_destroy(queue_ptr);
     free(queue_ptr);
     free(worker_params);
     free(worker_threads);
@@ -395,28 +338,9 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
-    /* Initialize queue protection variables. DO NOT TOUCH. */
-    queue_lock = (sem_t *)malloc(sizeof(sem_t));
-    queue_signal = (sem_t *)malloc(sizeof(sem_t));
-    ret_val = sem_init(queue_lock, 0, 1);
-    if (ret_val < 0) {
-        ERROR_INFO();
-        perror("Unable to initialize queue mutex");
-        return EXIT_FAILURE;
-    }
-    ret_val = sem_init(queue_signal, 0, 0);
-    if (ret_val < 0) {
-        ERROR_INFO();
-        perror("Unable to initialize queue notify");
-        return EXIT_FAILURE;
-    }
-    /* DONE - Initialize queue protection variables */
-
     /* Ready to handle the new connection with the client. */
     handle_client_connection(client_fd, conn_settings);
 
-    free(queue_lock);
-    free(queue_signal);
     free(print_mutex);
 
     close(server_fd);
@@ -68,7 +68,7 @@ uint64_t get_elapsed_busywait(long sec, long nsec)
 	/* Busy wait until enough time has elapsed */
 	do {
 		clock_gettime(CLOCK_MONOTONIC, &now);
-	} while (time_end.tv_sec > now.tv_sec || time_end.tv_nsec > now.tv_nsec);
+	} while (timespec_cmp(&time_end, &now) > 0);
 
 	/* Get end timestamp */
 	get_clocks(end);
@@ -85,7 +85,7 @@ void timespec_add (struct timespec * a, struct timespec * b)
 	 * seconds */
 	time_t addl_seconds = b->tv_sec;
 	a->tv_nsec += b->tv_nsec;
-	if (a->tv_nsec > NANO_IN_SEC) {
+	if (a->tv_nsec >= NANO_IN_SEC) {
 		addl_seconds += a->tv_nsec / NANO_IN_SEC;
 		a->tv_nsec = a->tv_nsec % NANO_IN_SEC;
 	}
@@ -111,5 +111,5 @@ int timespec_cmp(struct timespec *a, struct timespec *b)
  * parameter */
 uint64_t busywait_timespec(struct timespec delay)
 {
-	/* IMPLEMENT ME! (Optional but useful) */
+	return get_elapsed_busywait(delay.tv_sec, delay.tv_nsec);
 }